@@ -10,6 +10,14 @@
 
   Prefetches are issued into the L2 or LLC depending on L2 MSHR occupancy.
 
+  A stream that reaches the end of its page leaves a pending entry for the
+  instruction driving it.  When that instruction's first access to a new
+  page lands near the start of the page in the stream's direction, the new
+  detector takes over the stream's direction and confidence and prefetches
+  right away, instead of training again.  Pending entries are matched by
+  IP, because the L2 sees physical addresses and the next virtual page is
+  rarely the adjacent physical one.
+
  */
 
 #include <stdio.h>
@@ -18,6 +26,11 @@
 #define STREAM_DETECTOR_COUNT 64
 #define STREAM_WINDOW 16
 #define PREFETCH_DEGREE 2
+#define PENDING_STREAM_COUNT 16
+// a stream hands off once it is accessed within PENDING_EDGE lines of the end of its page
+#define PENDING_EDGE 4
+// and the next page continues it if first accessed within PENDING_REACH lines of its start
+#define PENDING_REACH 8
 
 typedef struct stream_detector
 {
@@ -32,11 +45,27 @@ typedef struct stream_detector
 
   // cache line index within the page where prefetches will be issued
   int pf_index;
+
+  // set when this detector took its stream over from the previous page
+  int continued;
 } stream_detector_t;
 
 stream_detector_t detectors[STREAM_DETECTOR_COUNT];
 int replacement_index;
 
+typedef struct pending_stream
+{
+  // the instruction driving the stream, 0 if this entry is free
+  unsigned long long int ip;
+
+  // direction and confidence the stream hands to its next page's detector
+  int direction;
+  int confidence;
+} pending_stream_t;
+
+pending_stream_t pending[PENDING_STREAM_COUNT];
+int pending_replacement_index;
+
 void l2_prefetcher_initialize(int cpu_num)
 {
   printf("Streaming Prefetcher\n");
@@ -50,9 +79,19 @@ void l2_prefetcher_initialize(int cpu_num)
       detectors[i].direction = 0;
       detectors[i].confidence = 0;
       detectors[i].pf_index = -1;
+      detectors[i].continued = 0;
     }
 
   replacement_index = 0;
+
+  for(i=0; i<PENDING_STREAM_COUNT; i++)
+    {
+      pending[i].ip = 0;
+      pending[i].direction = 0;
+      pending[i].confidence = 0;
+    }
+
+  pending_replacement_index = 0;
 }
 
 void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned long long int ip, int cache_hit)
@@ -92,10 +131,30 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
       detectors[detector_index].direction = 0;
       detectors[detector_index].confidence = 0;
       detectors[detector_index].pf_index = page_offset;
+      detectors[detector_index].continued = 0;
+
+      // continue a stream this instruction ran off the end of its last page
+      for(i=0; i<PENDING_STREAM_COUNT; i++)
+	{
+	  if((pending[i].ip == ip) &&
+	     (((pending[i].direction == 1) && (page_offset < PENDING_REACH)) ||
+	      ((pending[i].direction == -1) && (page_offset > 63-PENDING_REACH))))
+	    {
+	      detectors[detector_index].direction = pending[i].direction;
+	      detectors[detector_index].confidence = pending[i].confidence;
+	      detectors[detector_index].continued = 1;
+	      pending[i].ip = 0;
+	      break;
+	    }
+	}
     }
 
+  // demands trailing the prefetches of a continued stream are no reason to retrain it
+  int trailing = detectors[detector_index].continued &&
+    ((page_offset - detectors[detector_index].pf_index) * detectors[detector_index].direction < 0);
+
   // train on the new access
-  if(page_offset > detectors[detector_index].pf_index)
+  if(!trailing && (page_offset > detectors[detector_index].pf_index))
     {
       // accesses outside the STREAM_WINDOW do not train the detector
       if((page_offset-detectors[detector_index].pf_index) < STREAM_WINDOW)
@@ -114,7 +173,7 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
 	  detectors[detector_index].direction = 1;
 	}
     }
-  else if(page_offset < detectors[detector_index].pf_index)
+  else if(!trailing && (page_offset < detectors[detector_index].pf_index))
     {
       // accesses outside the STREAM_WINDOW do not train the detector
       if((detectors[detector_index].pf_index-page_offset) < STREAM_WINDOW)
@@ -137,6 +196,35 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
   // prefetch if confidence is high enough
   if(detectors[detector_index].confidence >= 2)
     {
+      // near the end of the page, get ready to hand the stream to the next one
+      if(((detectors[detector_index].direction == 1) && (page_offset >= 64-PENDING_EDGE)) ||
+	 ((detectors[detector_index].direction == -1) && (page_offset < PENDING_EDGE)))
+	{
+	  int pending_index = -1;
+	  for(i=0; i<PENDING_STREAM_COUNT; i++)
+	    {
+	      if(pending[i].ip == ip)
+		{
+		  pending_index = i;
+		  break;
+		}
+	    }
+
+	  if(pending_index == -1)
+	    {
+	      pending_index = pending_replacement_index;
+	      pending_replacement_index++;
+	      if(pending_replacement_index >= PENDING_STREAM_COUNT)
+		{
+		  pending_replacement_index = 0;
+		}
+	    }
+
+	  pending[pending_index].ip = ip;
+	  pending[pending_index].direction = detectors[detector_index].direction;
+	  pending[pending_index].confidence = detectors[detector_index].confidence;
+	}
+
       int i;
       for(i=0; i<PREFETCH_DEGREE; i++)
 	{
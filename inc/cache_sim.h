@@ -0,0 +1,67 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Extra functions offered to prefetchers by the functional cache simulator
+  in tools/cache_sim.c.  They do not exist in lib/dpc2sim.a, so a prefetcher
+  that calls them can only be linked against tools/cache_sim.c.
+
+ */
+
+#ifndef DPC2_CACHE_SIM_H
+#define DPC2_CACHE_SIM_H
+
+#include "prefetcher.h"
+
+// Returns 1 if the 4 KB page holding addr is resident in the L1 DTLB or the L2 STLB, and 0 if
+// touching it would start a page walk.  Always returns 1 when the simulator runs without -tlb.
+int dtlb_page_resident(int cpu_num, unsigned long long int addr);
+
+// Embedding interface, present when tools/cache_sim.c is compiled with -DCACHE_SIM_LIBRARY.
+
+typedef struct cache_sim_stats
+{
+	// retired in total, and since warmup completed
+	unsigned long long int instructions;
+	unsigned long long int stats_instructions;
+	int warmup_complete;
+	// set once the trace or -simulation_instructions has run out
+	int ended;
+
+	// demand statistics since warmup, indexed DCU, MLC, LLC
+	unsigned long long int access[3];
+	unsigned long long int miss[3];
+	unsigned long long int prefetch_fills[3];
+	unsigned long long int prefetch_useful[3];
+
+	unsigned long long int prefetches_requested;
+	unsigned long long int prefetches_issued;
+	unsigned long long int dram_reads;
+	unsigned long long int dram_writes;
+	unsigned long long int estimated_cycles;
+} cache_sim_stats_t;
+
+// Configures the simulator with the same switches as the command line (without the program
+// name), and opens the trace, a .dpc or .dpc.gz file.  Returns 0, or -1 on failure or when
+// a simulator already exists.
+int sim_create(int argc, char **argv, const char *trace_path);
+
+// Simulates up to count more instructions, warmup included, and returns how many it did.
+// Fewer than count means the simulation has ended, and its final stats have been printed.
+unsigned long long int sim_run(unsigned long long int count);
+
+void sim_get_stats(cache_sim_stats_t *stats);
+
+// The -interval time series recorded so far, one array of sim_interval_rows() counters per
+// column; NULL for a column outside the time series.
+int sim_interval_rows();
+const char *sim_interval_column_name(int column);
+const unsigned long long int *sim_interval_column(int column);
+
+// Frees the simulation, ending it first without printing final stats if it is still running.
+// The library holds no simulator afterwards, and should be unloaded.
+void sim_destroy();
+
+#endif
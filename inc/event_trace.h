@@ -0,0 +1,260 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Memory request event tracing for prefetchers
+
+  Records every L2 demand access, prefetch, fill and eviction the prefetcher
+  sees inside a window of cycles, and writes them as Chrome trace JSON, which
+  chrome://tracing and https://ui.perfetto.dev can display.
+
+  Tracing is off unless the window is set in the environment:
+
+    DPC2_EVENT_TRACE_START   first cycle to record
+    DPC2_EVENT_TRACE_CYCLES  length of the window in cycles (default 100000)
+    DPC2_EVENT_TRACE_FILE    output file (default events.json)
+
+  Each request becomes an async span, from its demand miss or prefetch issue
+  until its L2 fill, keyed by the request so that concurrent misses may
+  overlap freely; LLC prefetches and hits are instants, as the simulator
+  does not report LLC fills.  Requests that are still waiting for their fill
+  when the window ends are counted rather than shown.  L2 MSHR and read
+  queue occupancy are shown as counters.  One trace timestamp unit is one
+  cycle.
+
+  Events go into a buffer allocated once at startup, so recording never
+  allocates, locks or writes files; events past its end are counted and
+  dropped.  The JSON is written by event_trace_write(), normally from
+  l2_prefetcher_final_stats().
+
+  Include this header in exactly one prefetcher file.
+
+ */
+
+#ifndef DPC2_EVENT_TRACE_H
+#define DPC2_EVENT_TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "prefetcher.h"
+
+#define EVENT_TRACE_CAPACITY (1 << 20)
+
+#define EVENT_DEMAND_HIT 0
+#define EVENT_DEMAND_MISS 1
+#define EVENT_PREFETCH 2
+#define EVENT_PREFETCH_DROPPED 3
+#define EVENT_FILL 4
+#define EVENT_EVICT 5
+
+typedef struct trace_event
+{
+	unsigned long long int cycle;
+	unsigned long long int addr;
+	unsigned char type;
+	// FILL_L2 or FILL_LLC for prefetches, the prefetch flag for fills
+	unsigned char fill_level;
+	unsigned char mshr_occupancy;
+	unsigned char read_queue_occupancy;
+} trace_event_t;
+
+static trace_event_t *event_buffer;
+static int event_count;
+static unsigned long long int event_dropped;
+static unsigned long long int event_window_start, event_window_end;
+static const char *event_file = "events.json";
+
+static void event_trace_initialize()
+{
+	const char *start = getenv("DPC2_EVENT_TRACE_START");
+	const char *cycles = getenv("DPC2_EVENT_TRACE_CYCLES");
+	const char *file = getenv("DPC2_EVENT_TRACE_FILE");
+
+	if (start == NULL)
+		return;
+
+	event_window_start = strtoull(start, NULL, 0);
+	event_window_end = event_window_start + (cycles ? strtoull(cycles, NULL, 0) : 100000);
+	if (file != NULL)
+		event_file = file;
+
+	event_buffer = malloc(EVENT_TRACE_CAPACITY * sizeof(trace_event_t));
+	if (event_buffer == NULL)
+		fprintf(stderr, "Event trace disabled: out of memory\n");
+	else
+		printf("Tracing memory events in cycles [%llu, %llu) to %s\n", event_window_start, event_window_end, event_file);
+}
+
+static void event_trace_record(int type, unsigned long long int addr, int fill_level)
+{
+	if (event_buffer == NULL)
+		return;
+
+	unsigned long long int cycle = get_current_cycle(0);
+	if (cycle < event_window_start || cycle >= event_window_end)
+		return;
+	if (event_count == EVENT_TRACE_CAPACITY) {
+		event_dropped++;
+		return;
+	}
+
+	trace_event_t *e = &event_buffer[event_count++];
+	e->cycle = cycle;
+	e->addr = addr >> 6;
+	e->type = type;
+	e->fill_level = fill_level;
+	e->mshr_occupancy = get_l2_mshr_occupancy(0);
+	e->read_queue_occupancy = get_l2_read_queue_occupancy(0);
+}
+
+// Call from l2_prefetcher_operate().
+static void event_trace_demand(unsigned long long int addr, int cache_hit)
+{
+	event_trace_record(cache_hit ? EVENT_DEMAND_HIT : EVENT_DEMAND_MISS, addr, 0);
+}
+
+// Call after every l2_prefetch_line(), with its return value.
+static void event_trace_prefetch(unsigned long long int pf_addr, int fill_level, int issued)
+{
+	event_trace_record(issued ? EVENT_PREFETCH : EVENT_PREFETCH_DROPPED, pf_addr, fill_level);
+}
+
+// Call from l2_cache_fill().
+static void event_trace_fill(unsigned long long int addr, int prefetch, unsigned long long int evicted_addr)
+{
+	if (evicted_addr != 0)
+		event_trace_record(EVENT_EVICT, evicted_addr, 0);
+	event_trace_record(EVENT_FILL, addr, prefetch);
+}
+
+// Chrome trace lanes (thread ids)
+#define LANE_DEMAND 1
+#define LANE_PREFETCH_L2 2
+#define LANE_PREFETCH_LLC 3
+#define LANE_EVICT 4
+
+static void event_trace_instant(FILE *f, trace_event_t *e, const char *name, int lane)
+{
+	fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%d,\"ts\":%llu,\"args\":{\"addr\":\"0x%llx\"}}",
+	        name, lane, e->cycle, e->addr << 6);
+}
+
+// Writes the recorded events as Chrome trace JSON.  Demand misses and L2 prefetches are
+// matched with the next fill of the same line to become async spans, with the index of the
+// request's event as their id.
+static void event_trace_write()
+{
+	if (event_buffer == NULL)
+		return;
+
+	FILE *f = fopen(event_file, "w");
+	if (f == NULL) {
+		perror(event_file);
+		return;
+	}
+
+	// open requests, chained per line through pending_next; the table maps a line to its chain
+	int *pending_next = malloc(event_count * sizeof(int));
+	int table_size = 1;
+	while (table_size < 2 * event_count)
+		table_size <<= 1;
+	unsigned long long int *table_line = calloc(table_size, sizeof(unsigned long long int));
+	int *table_head = malloc(table_size * sizeof(int));
+	int *table_used = calloc(table_size, sizeof(int));
+	if (pending_next == NULL || table_line == NULL || table_head == NULL || table_used == NULL) {
+		fprintf(stderr, "Event trace: out of memory\n");
+		fclose(f);
+		return;
+	}
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"demand\"}},\n", LANE_DEMAND);
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"prefetch FILL_L2\"}},\n", LANE_PREFETCH_L2);
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"prefetch FILL_LLC\"}},\n", LANE_PREFETCH_LLC);
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"eviction\"}}", LANE_EVICT);
+
+	int i;
+	for (i = 0; i < event_count; i++) {
+		trace_event_t *e = &event_buffer[i];
+		int slot = (e->addr * 0x9e3779b97f4a7c15ULL) & (table_size - 1);
+		while (table_used[slot] && table_line[slot] != e->addr)
+			slot = (slot + 1) & (table_size - 1);
+		if (!table_used[slot]) {
+			table_used[slot] = 1;
+			table_line[slot] = e->addr;
+			table_head[slot] = -1;
+		}
+
+		if (i == 0 || e->mshr_occupancy != event_buffer[i - 1].mshr_occupancy || e->read_queue_occupancy != event_buffer[i - 1].read_queue_occupancy)
+			fprintf(f, ",\n{\"name\":\"L2 occupancy\",\"ph\":\"C\",\"pid\":0,\"ts\":%llu,\"args\":{\"mshr\":%d,\"read_queue\":%d}}",
+			        e->cycle, e->mshr_occupancy, e->read_queue_occupancy);
+
+		switch (e->type) {
+		case EVENT_DEMAND_HIT:
+			event_trace_instant(f, e, "L2 hit", LANE_DEMAND);
+			break;
+		case EVENT_PREFETCH_DROPPED:
+			event_trace_instant(f, e, (e->fill_level == FILL_LLC) ? "LLC prefetch dropped" : "L2 prefetch dropped",
+			                    (e->fill_level == FILL_LLC) ? LANE_PREFETCH_LLC : LANE_PREFETCH_L2);
+			break;
+		case EVENT_EVICT:
+			event_trace_instant(f, e, "L2 eviction", LANE_EVICT);
+			break;
+		case EVENT_PREFETCH:
+			if (e->fill_level == FILL_LLC) {
+				event_trace_instant(f, e, "LLC prefetch", LANE_PREFETCH_LLC);
+				break;
+			}
+			// fall through, an L2 prefetch waits for its fill like a demand miss
+		case EVENT_DEMAND_MISS:
+			pending_next[i] = table_head[slot];
+			table_head[slot] = i;
+			break;
+		case EVENT_FILL:
+			while (table_head[slot] >= 0) {
+				trace_event_t *b = &event_buffer[table_head[slot]];
+				int demand = (b->type == EVENT_DEMAND_MISS);
+				const char *name = demand ? "L2 miss" : "L2 prefetch";
+				const char *category = demand ? "demand" : "prefetch";
+				int lane = demand ? LANE_DEMAND : LANE_PREFETCH_L2;
+				fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\",\"id\":%d,\"pid\":0,\"tid\":%d,\"ts\":%llu,"
+				        "\"args\":{\"addr\":\"0x%llx\",\"filled_as_prefetch\":%d}}",
+				        name, category, table_head[slot], lane, b->cycle, b->addr << 6, e->fill_level);
+				fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\",\"id\":%d,\"pid\":0,\"tid\":%d,\"ts\":%llu}",
+				        name, category, table_head[slot], lane, e->cycle);
+				table_head[slot] = pending_next[table_head[slot]];
+			}
+			break;
+		}
+	}
+
+	// requests whose fill came after the window, or was never reported, have no span
+	unsigned long long int unmatched = 0;
+	for (i = 0; i < table_size; i++) {
+		if (!table_used[i])
+			continue;
+		int request;
+		for (request = table_head[i]; request >= 0; request = pending_next[request])
+			unmatched++;
+	}
+
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"time_unit\":\"cycles\",\"dropped_events\":%llu,\"unmatched_requests\":%llu}}\n",
+	        event_dropped, unmatched);
+	fclose(f);
+
+	printf("Wrote %d memory events to %s", event_count, event_file);
+	if (event_dropped)
+		printf(" (%llu dropped, buffer full)", event_dropped);
+	if (unmatched)
+		printf(" (%llu requests without a fill in the window, not shown)", unmatched);
+	printf("\n");
+
+	free(pending_next);
+	free(table_line);
+	free(table_head);
+	free(table_used);
+}
+
+#endif
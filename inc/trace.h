@@ -0,0 +1,66 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Layout of one instruction record in a .dpc trace, as written by
+  pintool/dpc2_tracer.so.  Every record is exactly 48 bytes.  A zero
+  register or memory field means the slot is unused.
+
+ */
+
+#ifndef DPC2_TRACE_H
+#define DPC2_TRACE_H
+
+#define NUM_INSTR_DESTINATIONS 1
+#define NUM_INSTR_SOURCES 3
+
+typedef struct trace_instr_format
+{
+	// instruction pointer (program counter) of this instruction
+	unsigned long long int ip;
+
+	// register ids written and read by this instruction
+	unsigned char destination_registers[NUM_INSTR_DESTINATIONS];
+	unsigned char source_registers[NUM_INSTR_SOURCES];
+
+	// virtual byte addresses stored to and loaded from by this instruction
+	unsigned long long int destination_memory[NUM_INSTR_DESTINATIONS];
+	unsigned long long int source_memory[NUM_INSTR_SOURCES];
+} trace_instr_format_t;
+
+// the register id the tracer uses for the instruction pointer; writing it marks a branch
+#define REG_INSTRUCTION_POINTER 26
+
+#define TRACE_RECORD_SIZE 48
+
+// fails to compile if the compiler pads the record differently from the tracer
+typedef char trace_record_size_check[(sizeof(trace_instr_format_t) == TRACE_RECORD_SIZE) ? 1 : -1];
+
+/*
+
+  Memory-only traces (.dpcm), written by tools/trace_project.c, keep only
+  the memory operations of a .dpc trace, in blocks of columns:
+
+    char magic[8] = MEMORY_TRACE_MAGIC
+    blocks, each:
+      unsigned int count                      1 to MEMORY_TRACE_BLOCK operations
+      unsigned long long int ip[count]
+      unsigned long long int addr[count]
+      unsigned int gap[count]                 instructions since the previous operation's
+                                              instruction; 0 if it is the same instruction
+      unsigned char store[count]              1 for a store, 0 for a load
+    unsigned int 0                            end of blocks
+    unsigned long long int trailing           instructions after the last operation's
+
+  The operations of one instruction are its loads, then its store.  The first
+  operation's gap counts from an imaginary instruction before the trace, so
+  instruction numbers are preserved exactly.
+
+ */
+
+#define MEMORY_TRACE_MAGIC "DPC2MEM1"
+#define MEMORY_TRACE_BLOCK 4096
+
+#endif
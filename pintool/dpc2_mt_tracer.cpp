@@ -0,0 +1,265 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Per-thread Pin tracer
+
+  Like dpc2_tracer.so, but writes one .dpc trace per application thread
+  instead of interleaving all threads into one stream.  Every instruction
+  gets a global sequence number, in the order the threads executed them;
+  each thread's trace is paired with a timestamp file that maps every
+  -timestamp_interval'th record of the thread to its sequence number, so
+  the threads can be lined up again when they are replayed together.
+
+  For -o prefix, the tracer writes:
+    prefix.t<N>.dpc   the trace of Pin thread N, in the usual 48-byte records
+    prefix.t<N>.ts    pairs of unsigned long long int (record number, sequence number)
+    prefix.index      one line per thread:
+                        thread <N> <OS thread id> <instructions> <first sequence> <last sequence> <trace file>
+
+  -s and -t count instructions over all threads together.
+
+  Build it like any other Pin 2.13 tool, for example from
+  source/tools/ManualExamples with this file copied there:
+    make obj-intel64/dpc2_mt_tracer.so
+  and run it like dpc2_tracer.so:
+    pin -t dpc2_mt_tracer.so -o traces/server -t 100000000 -- <your program here>
+
+ */
+
+#include "pin.H"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "../inc/trace.h"
+
+KNOB<std::string> KnobOutputPrefix(KNOB_MODE_WRITEONCE, "pintool", "o", "default_trace",
+                                   "prefix of the per-thread traces and the index");
+KNOB<UINT64> KnobSkipInstructions(KNOB_MODE_WRITEONCE, "pintool", "s", "0",
+                                  "instructions to skip before tracing begins, over all threads");
+KNOB<UINT64> KnobTraceInstructions(KNOB_MODE_WRITEONCE, "pintool", "t", "1000000",
+                                   "instructions to trace, over all threads");
+KNOB<UINT64> KnobTimestampInterval(KNOB_MODE_WRITEONCE, "pintool", "timestamp_interval", "1024",
+                                   "records between two timestamps of a thread");
+
+typedef struct thread_state
+{
+	OS_THREAD_ID os_tid;
+	FILE *trace;
+	FILE *timestamps;
+
+	// the instruction being recorded, valid while tracing is set
+	trace_instr_format_t rec;
+	int tracing;
+
+	UINT64 instructions;
+	UINT64 first_sequence;
+	UINT64 last_sequence;
+} thread_state_t;
+
+static TLS_KEY tls_key;
+static PIN_LOCK threads_lock;
+static thread_state_t *threads[PIN_MAX_THREADS];
+static volatile UINT64 sequence;
+static UINT64 trace_end;
+
+static thread_state_t *state(THREADID tid)
+{
+	return static_cast<thread_state_t *>(PIN_GetThreadData(tls_key, tid));
+}
+
+static void ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+	thread_state_t *t = new thread_state_t;
+	memset(t, 0, sizeof(*t));
+	t->os_tid = PIN_GetTid();
+
+	char name[4096];
+	snprintf(name, sizeof(name), "%s.t%u.dpc", KnobOutputPrefix.Value().c_str(), tid);
+	t->trace = fopen(name, "wb");
+	snprintf(name, sizeof(name), "%s.t%u.ts", KnobOutputPrefix.Value().c_str(), tid);
+	t->timestamps = fopen(name, "wb");
+	if (t->trace == NULL || t->timestamps == NULL) {
+		fprintf(stderr, "Cannot create the trace files of thread %u\n", tid);
+		PIN_ExitProcess(1);
+	}
+
+	PIN_SetThreadData(tls_key, t, tid);
+	PIN_GetLock(&threads_lock, tid + 1);
+	threads[tid] = t;
+	PIN_ReleaseLock(&threads_lock);
+}
+
+static void BeginInstruction(VOID *ip, THREADID tid)
+{
+	thread_state_t *t = state(tid);
+	UINT64 s = __sync_fetch_and_add(&sequence, 1);
+
+	t->tracing = (s >= KnobSkipInstructions.Value() && s < trace_end);
+	if (!t->tracing) {
+		if (s == trace_end)
+			PIN_ExitApplication(0);
+		return;
+	}
+
+	memset(&t->rec, 0, sizeof(t->rec));
+	t->rec.ip = (unsigned long long int)ip;
+
+	if (t->instructions == 0)
+		t->first_sequence = s;
+	t->last_sequence = s;
+	if (t->instructions % KnobTimestampInterval.Value() == 0) {
+		UINT64 pair[2] = { t->instructions, s };
+		fwrite(pair, sizeof(pair), 1, t->timestamps);
+	}
+}
+
+static void EndInstruction(THREADID tid)
+{
+	thread_state_t *t = state(tid);
+	if (!t->tracing)
+		return;
+	fwrite(&t->rec, sizeof(t->rec), 1, t->trace);
+	t->instructions++;
+}
+
+static void RegRead(UINT32 r, THREADID tid)
+{
+	thread_state_t *t = state(tid);
+	if (!t->tracing)
+		return;
+	int i;
+	for (i = 0; i < NUM_INSTR_SOURCES; i++)
+		if (t->rec.source_registers[i] == 0) {
+			t->rec.source_registers[i] = (unsigned char)r;
+			break;
+		}
+}
+
+static void RegWrite(UINT32 r, THREADID tid)
+{
+	thread_state_t *t = state(tid);
+	if (!t->tracing)
+		return;
+	int i;
+	for (i = 0; i < NUM_INSTR_DESTINATIONS; i++)
+		if (t->rec.destination_registers[i] == 0) {
+			t->rec.destination_registers[i] = (unsigned char)r;
+			break;
+		}
+}
+
+static void MemoryRead(VOID *addr, THREADID tid)
+{
+	thread_state_t *t = state(tid);
+	if (!t->tracing)
+		return;
+	int i;
+	for (i = 0; i < NUM_INSTR_SOURCES; i++)
+		if (t->rec.source_memory[i] == 0) {
+			t->rec.source_memory[i] = (unsigned long long int)addr;
+			break;
+		}
+}
+
+static void MemoryWrite(VOID *addr, THREADID tid)
+{
+	thread_state_t *t = state(tid);
+	if (!t->tracing)
+		return;
+	int i;
+	for (i = 0; i < NUM_INSTR_DESTINATIONS; i++)
+		if (t->rec.destination_memory[i] == 0) {
+			t->rec.destination_memory[i] = (unsigned long long int)addr;
+			break;
+		}
+}
+
+static void Instruction(INS ins, VOID *v)
+{
+	INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)BeginInstruction, IARG_INST_PTR, IARG_THREAD_ID, IARG_END);
+
+	UINT32 i;
+	for (i = 0; i < INS_MaxNumRRegs(ins); i++)
+		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)RegRead, IARG_UINT32, INS_RegR(ins, i), IARG_THREAD_ID, IARG_END);
+	for (i = 0; i < INS_MaxNumWRegs(ins); i++)
+		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)RegWrite, IARG_UINT32, INS_RegW(ins, i), IARG_THREAD_ID, IARG_END);
+
+	for (i = 0; i < INS_MemoryOperandCount(ins); i++) {
+		if (INS_MemoryOperandIsRead(ins, i))
+			INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)MemoryRead, IARG_MEMORYOP_EA, i, IARG_THREAD_ID, IARG_END);
+		if (INS_MemoryOperandIsWritten(ins, i))
+			INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)MemoryWrite, IARG_MEMORYOP_EA, i, IARG_THREAD_ID, IARG_END);
+	}
+
+	// the record is complete once every operand has been seen, so write it before the instruction runs
+	INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)EndInstruction, IARG_THREAD_ID, IARG_END);
+}
+
+static void CloseThread(thread_state_t *t)
+{
+	if (t->trace != NULL)
+		fclose(t->trace);
+	if (t->timestamps != NULL)
+		fclose(t->timestamps);
+	t->trace = NULL;
+	t->timestamps = NULL;
+}
+
+static void ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+	PIN_GetLock(&threads_lock, tid + 1);
+	CloseThread(threads[tid]);
+	PIN_ReleaseLock(&threads_lock);
+}
+
+static void Fini(INT32 code, VOID *v)
+{
+	std::string index_name = KnobOutputPrefix.Value() + ".index";
+	FILE *index = fopen(index_name.c_str(), "w");
+	if (index == NULL) {
+		fprintf(stderr, "Cannot create %s\n", index_name.c_str());
+		return;
+	}
+
+	THREADID tid;
+	for (tid = 0; tid < PIN_MAX_THREADS; tid++) {
+		thread_state_t *t = threads[tid];
+		if (t == NULL)
+			continue;
+		CloseThread(t);
+		fprintf(index, "thread %u %u %llu %llu %llu %s.t%u.dpc\n", tid, (unsigned int)t->os_tid,
+		        (unsigned long long int)t->instructions, (unsigned long long int)t->first_sequence,
+		        (unsigned long long int)t->last_sequence, KnobOutputPrefix.Value().c_str(), tid);
+	}
+	fclose(index);
+}
+
+static INT32 Usage()
+{
+	fprintf(stderr, "Writes one DPC2 trace per thread.\n%s\n", KNOB_BASE::StringKnobSummary().c_str());
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	if (PIN_Init(argc, argv))
+		return Usage();
+
+	trace_end = KnobSkipInstructions.Value() + KnobTraceInstructions.Value();
+	if (KnobTimestampInterval.Value() == 0)
+		return Usage();
+
+	PIN_InitLock(&threads_lock);
+	tls_key = PIN_CreateThreadDataKey(NULL);
+
+	PIN_AddThreadStartFunction(ThreadStart, NULL);
+	PIN_AddThreadFiniFunction(ThreadFini, NULL);
+	INS_AddInstrumentFunction(Instruction, NULL);
+	PIN_AddFiniFunction(Fini, NULL);
+
+	PIN_StartProgram();
+	return 0;
+}
@@ -5,366 +5,293 @@
 
 /*
 
-  This file describes a prefetcher that resembles a simplified version of the
-  Access Map Pattern Matching (AMPM) prefetcher, which won the first
-  Data Prefetching Championship.  The original AMPM prefetcher tracked large
-  regions of virtual address space to make prefetching decisions, but this
-  version works only on smaller 4 KB physical pages.
+  This file describes an Access Map Pattern Matching (AMPM) prefetcher,
+  after the one that won the first Data Prefetching Championship.
+
+  Memory is divided into 16 KB zones, and for each recently used zone the
+  prefetcher keeps the state of every cache line, 2 bits each, packed into
+  ZONE_WORDS machine words:
+    INIT      neither accessed nor prefetched
+    PREFETCH  prefetched, not accessed since
+    ACCESS    demand accessed
+    SUCCESS   prefetched, then demand accessed
+  A demand access moves a line to ACCESS, or from PREFETCH to SUCCESS,
+  which counts as a prefetch success.  A prefetched line evicted from the
+  L2 before any access (seen in l2_cache_fill()) goes back to INIT, and
+  counts as a failure, as do lines still in PREFETCH when their zone is
+  replaced.
+
+  On every access to line t, the prefetcher looks for strides k for which
+  t - k and t - 2k were accessed, and prefetches t + k (and likewise in the
+  negative direction), for the smallest such k first.  All strides up to
+  MAX_STRIDE are matched at once: the access map is turned into bit vectors
+  whose bit k stands for line t - k, t - 2k or t + k, and ANDed together.
+
+  Lines accessed in other pages of the zone count for matching, but only
+  lines in the same 4 KB page as the access can be prefetched.
+
+  After every EPOCH_RESOLVED successes and failures, the success ratio sets
+  the prefetch degree for each direction.
 
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include "../inc/prefetcher.h"
 
-#define AMPM_PAGE_COUNT 64
+#define ZONE_COUNT 64
+// 16 KB zones of 256 lines, at 32 lines per 64-bit word
+#define ZONE_LINES 256
+#define ZONE_WORDS (ZONE_LINES / 32)
+#define BITMAP_WORDS (ZONE_LINES / 64)
 
- // Parameters
-#define T_INTERVAL 512
-#define PREFETCH_EVICT_SIZE 4096
-#define A_HIGH 0.75
-#define A_LOW 0.40
-#define T_LAT 0.01
-#define T_POL 0.005
+#define MAX_STRIDE 16
+#define EPOCH_RESOLVED 256
 
-// #define DEBUG
+#define STATE_INIT 0
+#define STATE_PREFETCH 1
+#define STATE_ACCESS 2
+#define STATE_SUCCESS 3
 
+// the low bit of each 2-bit state
+#define EVEN_BITS 0x5555555555555555ULL
 
-#define MSHR_SIZE 2048
-int useful_bit[L2_SET_COUNT][L2_ASSOCIATIVITY];
-
-// This mshr is only for prefetched lines
-// mshr_addr stores addr >> 6
-unsigned long long int mshr_addr[MSHR_SIZE];
-int mshr_valid[MSHR_SIZE];
-int late_bit[MSHR_SIZE];
-int prefetch_evict[PREFETCH_EVICT_SIZE];
-// Values in interval
-int used_cnt, prefetch_cnt, late_cnt, miss_cnt, miss_prefetch_cnt, evict_cnt;
-// Values global
-float used_total, prefetch_total, late_total, miss_total, miss_prefetch_total;
-
-int prefetch_degree, stream_window, aggressive_level;
-
-typedef struct ampm_page
+typedef struct ampm_zone
 {
-	// page address
-	unsigned long long int page;
-
-	// The access map itself.
-	// Each element is set when the corresponding cache line is accessed.
-	// The whole structure is analyzed to make prefetching decisions.
-	// While this is coded as an integer array, it is used conceptually as a single 64-bit vector.
-	int access_map[64];
+	// zone address
+	unsigned long long int zone;
 
-	// This map represents cache lines in this page that have already been prefetched.
-	// We will only prefetch lines that haven't already been either demand accessed or prefetched.
-	int pf_map[64];
+	// The access map itself: line i's state is in bits 2 * (i % 32) of state[i / 32].
+	unsigned long long int state[ZONE_WORDS];
 
-	// used for page replacement
+	// used for zone replacement
 	unsigned long long int lru;
-} ampm_page_t;
+} ampm_zone_t;
 
-ampm_page_t ampm_pages[AMPM_PAGE_COUNT];
+ampm_zone_t ampm_zones[ZONE_COUNT];
 
-void l2_prefetcher_initialize(int cpu_num)
+int prefetch_degree;
+// successes and failures in the current epoch, and in total since warmup
+int epoch_success, epoch_failure;
+unsigned long long int success_total, failure_total, issued_total;
+unsigned long long int degree_epochs[MAX_STRIDE + 1];
+
+// Packs bits 0, 2, 4, ... 62 of x into the low 32 bits.
+unsigned long long int compress_even(unsigned long long int x)
 {
-	printf("AMPM Lite Prefetcher\n");
-	// you can inspect these knob values from your code to see which configuration you're runnig in
-	printf("Knobs visible from prefetcher: %d %d %d\n", knob_scramble_loads, knob_small_llc, knob_low_bandwidth);
+	x &= EVEN_BITS;
+	x = (x | (x >> 1)) & 0x3333333333333333ULL;
+	x = (x | (x >> 2)) & 0x0f0f0f0f0f0f0f0fULL;
+	x = (x | (x >> 4)) & 0x00ff00ff00ff00ffULL;
+	x = (x | (x >> 8)) & 0x0000ffff0000ffffULL;
+	x = (x | (x >> 16)) & 0x00000000ffffffffULL;
+	return x;
+}
 
-	int i, j;
-	for (i = 0; i < AMPM_PAGE_COUNT; i++)
-	{
-		ampm_pages[i].page = 0;
-		ampm_pages[i].lru = 0;
+unsigned long long int reverse_bits(unsigned long long int x)
+{
+	x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+	x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+	x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+	x = ((x >> 8) & 0x00ff00ff00ff00ffULL) | ((x & 0x00ff00ff00ff00ffULL) << 8);
+	x = ((x >> 16) & 0x0000ffff0000ffffULL) | ((x & 0x0000ffff0000ffffULL) << 16);
+	return (x >> 32) | (x << 32);
+}
 
-		for (j = 0; j < 64; j++)
-		{
-			ampm_pages[i].access_map[j] = 0;
-			ampm_pages[i].pf_map[j] = 0;
-		}
-	}
+int get_state(ampm_zone_t *z, int line)
+{
+	return (z->state[line / 32] >> (2 * (line % 32))) & 3;
+}
 
-	prefetch_degree = 2;
-	aggressive_level = 3;
-
-	used_total = 0;
-	prefetch_total = 0;
-	late_total = 0;
-	miss_total = 0;
-	miss_prefetch_total = 0;
-
-	used_cnt = 0;
-	prefetch_cnt = 0;
-	late_cnt = 0;
-	miss_cnt = 0;
-	miss_prefetch_cnt = 0;
-	evict_cnt = 0;
-
-	// Initial configuration
-	stream_window = 16;
-	prefetch_degree = 2;
-	aggressive_level = 3;
-
-	for (i = 0; i < L2_SET_COUNT; i++)
-		for (j = 0; j < L2_ASSOCIATIVITY; j++)
-			useful_bit[i][j] = 0;
-	for (i = 0; i < MSHR_SIZE; i++) {
-		late_bit[i] = 0;
-		mshr_valid[i] = 0;
+void set_state(ampm_zone_t *z, int line, int state)
+{
+	int shift = 2 * (line % 32);
+	z->state[line / 32] = (z->state[line / 32] & ~(3ULL << shift)) | ((unsigned long long int)state << shift);
+}
+
+// Builds bitmaps of the zone's accessed lines (ACCESS or SUCCESS) and INIT lines, one bit per line.
+void zone_bitmaps(ampm_zone_t *z, unsigned long long int *accessed, unsigned long long int *init)
+{
+	int w;
+	for (w = 0; w < BITMAP_WORDS; w++) {
+		unsigned long long int lo = z->state[2 * w], hi = z->state[2 * w + 1];
+		accessed[w] = compress_even(lo >> 1) | (compress_even(hi >> 1) << 32);
+		unsigned long long int init_lo = ~(lo | (lo >> 1)), init_hi = ~(hi | (hi >> 1));
+		init[w] = compress_even(init_lo) | (compress_even(init_hi) << 32);
 	}
-	for (i = 0; i < PREFETCH_EVICT_SIZE; i++)
-		prefetch_evict[i] = 0;
 }
 
-void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned long long int ip, int cache_hit)
+// Returns the 64 bits of a zone bitmap from line start on, as bit 0 up; lines outside the zone read as 0.
+unsigned long long int bitmap_window(unsigned long long int *bitmap, int start)
 {
-	// uncomment this line to see all the information available to make prefetch decisions
-	//printf("(0x%llx 0x%llx %d %d %d) ", addr, ip, cache_hit, get_l2_read_queue_occupancy(0), get_l2_mshr_occupancy(0));
+	if (start <= -64 || start >= ZONE_LINES)
+		return 0;
+	if (start < 0)
+		return bitmap[0] << -start;
+	int w = start / 64, shift = start % 64;
+	unsigned long long int x = bitmap[w] >> shift;
+	if (shift && w + 1 < BITMAP_WORDS)
+		x |= bitmap[w + 1] << (64 - shift);
+	return x;
+}
 
-	unsigned long long int cl_address = addr >> 6;
-	unsigned long long int page = cl_address >> 6;
-	unsigned long long int page_offset = cl_address & 63;
-
-	unsigned long long int a0 = cl_address & 0xfff;
-	unsigned long long int a1 = (cl_address >> 12) & 0xfff;
-	unsigned long long int virt_addr = a0 ^ a1;
-
-	if (cache_hit) {
-		// Check pref-bit for usefulness
-		int s = l2_get_set(addr);
-		assert(s < L2_SET_COUNT);
-		int w = l2_get_way(0, addr, s);
-		assert(w < L2_ASSOCIATIVITY && w >= 0);
-
-		if (useful_bit[s][w]) {
-			used_cnt++;
-			useful_bit[s][w] = 0;
-		}
+void reverse_bitmap(unsigned long long int *bitmap, unsigned long long int *reversed)
+{
+	int w;
+	for (w = 0; w < BITMAP_WORDS; w++)
+		reversed[w] = reverse_bits(bitmap[BITMAP_WORDS - 1 - w]);
+}
 
+ampm_zone_t *find_zone(unsigned long long int zone)
+{
+	int i;
+	for (i = 0; i < ZONE_COUNT; i++)
+		if (ampm_zones[i].zone == zone)
+			return &ampm_zones[i];
+	return NULL;
+}
 
+void resolve(int success)
+{
+	if (success) {
+		epoch_success++;
+		success_total++;
 	}
 	else {
-		miss_cnt++;
-
-		// Check pref-bit for lateness
-		int mshr_index = 0;
-		while (mshr_index < MSHR_SIZE) {
-			if (mshr_valid[mshr_index] && mshr_addr[mshr_index] == cl_address)
-				break;
-			mshr_index++;
-		}
+		epoch_failure++;
+		failure_total++;
+	}
+	if (epoch_success + epoch_failure < EPOCH_RESOLVED)
+		return;
+
+	float ratio = (float)epoch_success / (epoch_success + epoch_failure);
+	if (ratio < 0.25)
+		prefetch_degree = 1;
+	else if (ratio < 0.5)
+		prefetch_degree = 2;
+	else if (ratio < 0.75)
+		prefetch_degree = 3;
+	else if (ratio < 0.9)
+		prefetch_degree = 4;
+	else
+		prefetch_degree = 6;
+	degree_epochs[prefetch_degree]++;
+	epoch_success = 0;
+	epoch_failure = 0;
+}
 
-		if (mshr_index < MSHR_SIZE) {
-			if (late_bit[mshr_index]) {
-				late_cnt++;
-				used_cnt++;
-				late_bit[mshr_index] = 0;
-			}
-		}
+void l2_prefetcher_initialize(int cpu_num)
+{
+	printf("AMPM Prefetcher\n");
+	// you can inspect these knob values from your code to see which configuration you're runnig in
+	printf("Knobs visible from prefetcher: %d %d %d\n", knob_scramble_loads, knob_small_llc, knob_low_bandwidth);
 
-		// Check for cache pollution
-		if (prefetch_evict[virt_addr])
-			miss_prefetch_cnt++;
-	}
+	memset(ampm_zones, 0, sizeof(ampm_zones));
 
+	prefetch_degree = 2;
+	epoch_success = 0;
+	epoch_failure = 0;
+	success_total = 0;
+	failure_total = 0;
+	issued_total = 0;
+	memset(degree_epochs, 0, sizeof(degree_epochs));
+}
 
-	// check to see if we have a page hit
-	int page_index = -1;
-	int i;
-	for (i = 0; i < AMPM_PAGE_COUNT; i++)
-	{
-		if (ampm_pages[i].page == page)
-		{
-			page_index = i;
-			break;
-		}
+// Prefetches line pf_line of zone z, with base_addr the address of the current access.
+void issue_prefetch(ampm_zone_t *z, int pf_line, unsigned long long int base_addr)
+{
+	unsigned long long int pf_address = ((z->zone * ZONE_LINES) + pf_line) << 6;
+
+	// check the MSHR occupancy to decide if we're going to prefetch to the L2 or LLC
+	int fill_level = (get_l2_mshr_occupancy(0) < 8) ? FILL_L2 : FILL_LLC;
+	if (l2_prefetch_line(0, base_addr, pf_address, fill_level)) {
+		// mark the prefetched line so we don't prefetch it again
+		set_state(z, pf_line, STATE_PREFETCH);
+		issued_total++;
 	}
+}
+
+void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned long long int ip, int cache_hit)
+{
+	// uncomment this line to see all the information available to make prefetch decisions
+	// printf("(%lld 0x%llx 0x%llx %d %d %d) ", get_current_cycle(0), addr, ip, cache_hit, get_l2_read_queue_occupancy(0), get_l2_mshr_occupancy(0));
 
-	if (page_index == -1)
-	{
-		// the page was not found, so we must replace an old page with this new page
-
-		// find the oldest page
-		int lru_index = 0;
-		unsigned long long int lru_cycle = ampm_pages[lru_index].lru;
-		int i;
-		for (i = 0; i < AMPM_PAGE_COUNT; i++)
-		{
-			if (ampm_pages[i].lru < lru_cycle)
-			{
+	unsigned long long int cl_address = addr >> 6;
+	unsigned long long int zone = cl_address / ZONE_LINES;
+	int t = cl_address % ZONE_LINES;
+
+	ampm_zone_t *z = find_zone(zone);
+	if (z == NULL) {
+		// the zone was not found, so we must replace the oldest zone with this new zone
+		int i, lru_index = 0;
+		for (i = 0; i < ZONE_COUNT; i++)
+			if (ampm_zones[i].lru < ampm_zones[lru_index].lru)
 				lru_index = i;
-				lru_cycle = ampm_pages[lru_index].lru;
-			}
-		}
-		page_index = lru_index;
-
-		// reset the oldest page
-		ampm_pages[page_index].page = page;
-		for (i = 0; i < 64; i++)
-		{
-			ampm_pages[page_index].access_map[i] = 0;
-			ampm_pages[page_index].pf_map[i] = 0;
+		z = &ampm_zones[lru_index];
+
+		// prefetches never used while the zone was tracked are failures
+		int w;
+		for (w = 0; w < ZONE_WORDS; w++) {
+			unsigned long long int s = z->state[w];
+			int unused = __builtin_popcountll(s & ~(s >> 1) & EVEN_BITS);
+			while (unused-- > 0)
+				resolve(0);
 		}
+
+		memset(z, 0, sizeof(*z));
+		z->zone = zone;
 	}
 
 	// update LRU
-	ampm_pages[page_index].lru = get_current_cycle(0);
+	z->lru = get_current_cycle(0);
 
 	// mark the access map
-	ampm_pages[page_index].access_map[page_offset] = 1;
-
-	// positive prefetching
+	int state = get_state(z, t);
+	if (state == STATE_PREFETCH) {
+		set_state(z, t, STATE_SUCCESS);
+		resolve(1);
+	}
+	else if (state == STATE_INIT)
+		set_state(z, t, STATE_ACCESS);
+
+	unsigned long long int accessed[BITMAP_WORDS], init[BITMAP_WORDS];
+	unsigned long long int accessed_reversed[BITMAP_WORDS], init_reversed[BITMAP_WORDS];
+	zone_bitmaps(z, accessed, init);
+	reverse_bitmap(accessed, accessed_reversed);
+	reverse_bitmap(init, init_reversed);
+
+	// only lines in the page of the access can be prefetched
+	int page_first = t & ~63, page_last = page_first + 63;
+	int max_forward = (page_last - t < MAX_STRIDE) ? page_last - t : MAX_STRIDE;
+	int max_backward = (t - page_first < MAX_STRIDE) ? t - page_first : MAX_STRIDE;
+	unsigned long long int forward_mask = ((1ULL << (max_forward + 1)) - 1) & ~1ULL;
+	unsigned long long int backward_mask = ((1ULL << (max_backward + 1)) - 1) & ~1ULL;
+
+	// bit k of these is line t - k or t + k
+	unsigned long long int accessed_back = bitmap_window(accessed_reversed, ZONE_LINES - 1 - t);
+	unsigned long long int accessed_ahead = bitmap_window(accessed, t);
+	unsigned long long int init_back = bitmap_window(init_reversed, ZONE_LINES - 1 - t);
+	unsigned long long int init_ahead = bitmap_window(init, t);
+
+	// positive prefetching: t - k and t - 2k accessed, t + k not yet touched
+	unsigned long long int candidates = accessed_back & compress_even(accessed_back) & init_ahead & forward_mask;
 	int count_prefetches = 0;
-	for (i = 1; i <= 16; i++)
-	{
-		int check_index1 = page_offset - i;
-		int check_index2 = page_offset - 2 * i;
-		int pf_index = page_offset + i;
-
-		if (check_index2 < 0)
-		{
-			break;
-		}
-
-		if (pf_index > 63)
-		{
-			break;
-		}
-
-		if (count_prefetches >= prefetch_degree)
-		{
-			break;
-		}
-
-		if (ampm_pages[page_index].access_map[pf_index] == 1)
-		{
-			// don't prefetch something that's already been demand accessed
-			continue;
-		}
-
-		if (ampm_pages[page_index].pf_map[pf_index] == 1)
-		{
-			// don't prefetch something that's alrady been prefetched
-			continue;
-		}
-
-		if ((ampm_pages[page_index].access_map[check_index1] == 1) && (ampm_pages[page_index].access_map[check_index2] == 1))
-		{
-			// we found the stride repeated twice, so issue a prefetch
-
-			unsigned long long int pf_address = (page << 12) + (pf_index << 6);
-
-			// check the MSHR occupancy to decide if we're going to prefetch to the L2 or LLC
-			if (get_l2_mshr_occupancy(0) < 8)
-			{
-				l2_prefetch_line(0, addr, pf_address, FILL_L2);
-			}
-			else
-			{
-				l2_prefetch_line(0, addr, pf_address, FILL_LLC);
-			}
-
-			// mark the prefetched line so we don't prefetch it again
-			ampm_pages[page_index].pf_map[pf_index] = 1;
-			count_prefetches++;
-		}
+	while (candidates != 0 && count_prefetches < prefetch_degree) {
+		int k = __builtin_ctzll(candidates);
+		candidates &= candidates - 1;
+		issue_prefetch(z, t + k, addr);
+		count_prefetches++;
 	}
 
-	// negative prefetching
+	// negative prefetching: t + k and t + 2k accessed, t - k not yet touched
+	candidates = accessed_ahead & compress_even(accessed_ahead) & init_back & backward_mask;
 	count_prefetches = 0;
-	for (i = 1; i <= 16; i++)
-	{
-		int check_index1 = page_offset + i;
-		int check_index2 = page_offset + 2 * i;
-		int pf_index = page_offset - i;
-
-		if (check_index2 > 63)
-		{
-			break;
-		}
-
-		if (pf_index < 0)
-		{
-			break;
-		}
-
-		if (count_prefetches >= prefetch_degree)
-		{
-			break;
-		}
-
-		if (ampm_pages[page_index].access_map[pf_index] == 1)
-		{
-			// don't prefetch something that's already been demand accessed
-			continue;
-		}
-
-		if (ampm_pages[page_index].pf_map[pf_index] == 1)
-		{
-			// don't prefetch something that's alrady been prefetched
-			continue;
-		}
-
-		if ((ampm_pages[page_index].access_map[check_index1] == 1) && (ampm_pages[page_index].access_map[check_index2] == 1))
-		{
-			// we found the stride repeated twice, so issue a prefetch
-
-			unsigned long long int pf_address = (page << 12) + (pf_index << 6);
-
-			// check the MSHR occupancy to decide if we're going to prefetch to the L2 or LLC
-			if (get_l2_mshr_occupancy(0) < 12)
-			{
-				l2_prefetch_line(0, addr, pf_address, FILL_L2);
-
-				// Add to MSHR
-				int mshr_index = 0;
-				while (mshr_index < MSHR_SIZE) {
-					if (mshr_valid[mshr_index] && mshr_addr[mshr_index] == (pf_address >> 6))
-						break;
-					mshr_index++;
-				}
-
-				if (mshr_index == MSHR_SIZE) {
-					mshr_index = 0;
-					while (mshr_index < MSHR_SIZE) {
-						if (!mshr_valid[mshr_index])
-							break;
-						mshr_index++;
-					}
-					assert(mshr_index < MSHR_SIZE);
-
-					mshr_valid[mshr_index] = 1;
-					mshr_addr[mshr_index] = pf_address >> 6;
-					late_bit[mshr_index] = 1;
-				}
-
-#ifdef DEBUG
-				printf("\n");
-
-
-				for (mshr_index = 0; mshr_index < MSHR_SIZE; mshr_index++) {
-					if (mshr_valid[mshr_index]) {
-						printf("In MSHR: 0x%llx\n", mshr_addr[mshr_index] << 6);
-					}
-				}
-
-				// printf("MSHR: %d\n", get_l2_mshr_occupancy(0));
-
-				printf("{%lld 0x%llx 0x%llx %d %d %d}\n\n", get_current_cycle(0), pf_address, ip, cache_hit, get_l2_read_queue_occupancy(0), get_l2_mshr_occupancy(0));
-#endif
-
-			}
-			else
-			{
-				l2_prefetch_line(0, addr, pf_address, FILL_LLC);
-			}
-
-			// mark the prefetched line so we don't prefetch it again
-			ampm_pages[page_index].pf_map[pf_index] = 1;
-			count_prefetches++;
-		}
+	while (candidates != 0 && count_prefetches < prefetch_degree) {
+		int k = __builtin_ctzll(candidates);
+		candidates &= candidates - 1;
+		issue_prefetch(z, t - k, addr);
+		count_prefetches++;
 	}
 }
 
@@ -373,165 +300,20 @@ void l2_cache_fill(int cpu_num, unsigned long long int addr, int set, int way, i
 	assert(set < L2_SET_COUNT);
 	assert(way < L2_ASSOCIATIVITY);
 
-	if (evicted_addr != 0)
-		evict_cnt++;
-
-	// Virtual address
+	// a prefetch fill for a line the map lost track of, for example after a zone replacement
 	unsigned long long int cl_address = addr >> 6;
-	unsigned long long int cl_evict_address = evicted_addr >> 6;
-	unsigned long long int a0 = cl_evict_address & 0xfff;
-	unsigned long long int a1 = (cl_evict_address >> 12) & 0xfff;
-	unsigned long long int virt_addr = a0 ^ a1;
-
-	// Remove from mshr
-	int mshr_index = 0;
-	while (mshr_index < MSHR_SIZE) {
-		if (mshr_valid[mshr_index] && mshr_addr[mshr_index] == cl_address)
-			break;
-		mshr_index++;
-	}
-
-	if (mshr_index < MSHR_SIZE) {
-		// Set pref-bit for usefulness
-		useful_bit[set][way] = late_bit[mshr_index];
-
-		mshr_valid[mshr_index] = 0;
-		late_bit[mshr_index] = 0;
-	}
-
-	if (prefetch) {
-
-		prefetch_cnt++;
-		// Add to evicted bit vector
-		if (evicted_addr != 0)
-			prefetch_evict[virt_addr] = 1;
-	}
-	else {
-		useful_bit[set][way] = 0;
-		if (evicted_addr != 0)
-			prefetch_evict[virt_addr] = 0;
-	}
-
-	// Reset fetched bit vector
-	a0 = cl_address & 0xfff;
-	a1 = (cl_address >> 12) & 0xfff;
-	virt_addr = a0 ^ a1;
-	prefetch_evict[virt_addr] = 0;
-
-
-	// Check interval
-	if (evict_cnt == T_INTERVAL) {
-		evict_cnt = 0;
-
-		int j;
-		for (j = 0; j < MSHR_SIZE; j++)
-			if (mshr_valid[j])
-				prefetch_cnt++;
-		if (prefetch_cnt < used_cnt)
-			prefetch_cnt = used_cnt;
-
-		printf("Count: %d %d %d %d %d\n", used_cnt, prefetch_cnt, late_cnt, miss_cnt, miss_prefetch_cnt);
-
-		const float alpha = 0.5;
-
-		used_total = alpha * used_total + (1 - alpha) * used_cnt;
-		prefetch_total = alpha * prefetch_total + (1 - alpha) * prefetch_cnt;
-		late_total = alpha * late_total + (1 - alpha) * late_cnt;
-		miss_total = alpha * miss_total + (1 - alpha) * miss_cnt;
-		miss_prefetch_total = alpha * miss_prefetch_total + (1 - alpha) * miss_prefetch_cnt;
-
-		const float eps = 1e-3;
-		if (used_total < eps)
-			used_total = 0;
-		if (prefetch_total < eps)
-			prefetch_total = 0;
-		if (late_total < eps)
-			late_total = 0;
-		if (miss_total < eps)
-			miss_total = 0;
-		if (miss_prefetch_total < eps)
-			miss_prefetch_total = 0;
-
-		used_cnt = 0;
-		prefetch_cnt = 0;
-		late_cnt = 0;
-		miss_cnt = 0;
-		miss_prefetch_cnt = 0;
-
-
-		float acc = (prefetch_total == 0) ? 0 : (used_total / prefetch_total);
-		float lat = (used_total == 0) ? 0 : (late_total / used_total);
-		float pol = (miss_total == 0) ? 0 : (miss_prefetch_total / miss_total);
-
-		printf("Metric: acc %f  lat %f  pol %f\n", acc, lat, pol);
-
-		// acc_level: 0-Low, 1-Medium, 2-High
-		// lat_level: 0-Not_late, 1-Late
-		// pol_level: 0-Low, 1-High
-		int acc_level, lat_level, pol_level;
-		if (acc < A_LOW)
-			acc_level = 0;
-		else if (acc < A_HIGH)
-			acc_level = 1;
-		else
-			acc_level = 2;
-		lat_level = (lat < T_LAT) ? 0 : 1;
-		pol_level = (pol < T_POL) ? 0 : 1;
-
-		// Update Rule
-		int update_rule;
-		switch (acc_level) {
-		case 0:
-			if (lat_level) {
-				update_rule = -1;
-			}
-			else {
-				update_rule = (pol_level) ? -1 : 0;
-			}
-			break;
-		case 1:
-			if (lat_level) {
-				update_rule = (pol_level) ? -1 : 1;
-			}
-			else {
-				update_rule = (pol_level) ? -1 : 0;
-			}
-			break;
-		case 2:
-			if (lat_level) {
-				update_rule = 1;
-			}
-			else {
-				update_rule = (pol_level) ? -1 : 0;
-			}
-		}
-
-		aggressive_level += update_rule;
-		if (aggressive_level > 5)
-			aggressive_level = 5;
-		if (aggressive_level < 1)
-			aggressive_level = 1;
-
-		printf("Aggressive level: %d\n\n", aggressive_level);
-
-		switch (aggressive_level) {
-		case 1:
-			prefetch_degree = 1;
-			break;
-		case 2:
-			prefetch_degree = 1;
-			break;
-		case 3:
-			prefetch_degree = 2;
-			break;
-		case 4:
-			prefetch_degree = 4;
-			break;
-		case 5:
-			prefetch_degree = 4;
+	ampm_zone_t *z = find_zone(cl_address / ZONE_LINES);
+	if (prefetch && z != NULL && get_state(z, cl_address % ZONE_LINES) == STATE_INIT)
+		set_state(z, cl_address % ZONE_LINES, STATE_PREFETCH);
+
+	// a prefetched line leaving the L2 unused was a failure, and may be prefetched again
+	if (evicted_addr != 0) {
+		unsigned long long int cl_evict_address = evicted_addr >> 6;
+		z = find_zone(cl_evict_address / ZONE_LINES);
+		if (z != NULL && get_state(z, cl_evict_address % ZONE_LINES) == STATE_PREFETCH) {
+			set_state(z, cl_evict_address % ZONE_LINES, STATE_INIT);
+			resolve(0);
 		}
-
-
 	}
 #ifdef DEBUG
 	// uncomment this line to see the information available to you when there is a cache fill event
@@ -547,9 +329,20 @@ void l2_prefetcher_heartbeat_stats(int cpu_num)
 void l2_prefetcher_warmup_stats(int cpu_num)
 {
 	printf("Prefetcher warmup complete stats\n\n");
+	success_total = 0;
+	failure_total = 0;
+	issued_total = 0;
+	memset(degree_epochs, 0, sizeof(degree_epochs));
 }
 
 void l2_prefetcher_final_stats(int cpu_num)
 {
 	printf("Prefetcher final stats\n");
+	printf("Prefetches issued: %llu successes: %llu failures: %llu\n", issued_total, success_total, failure_total);
+	printf("Epochs at each degree:");
+	int d;
+	for (d = 1; d <= MAX_STRIDE; d++)
+		if (degree_epochs[d])
+			printf(" %d:%llu", d, degree_epochs[d]);
+	printf("\n");
 }
@@ -0,0 +1,344 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Berti prefetcher
+
+  Learns, for each IP, which line deltas would have brought its misses in
+  on time, in the manner of Berti.  Instead of prefetching a fixed number of
+  strides ahead, it measures how long fills take, and only trusts a delta
+  if a prefetch for it could have been issued that much earlier.
+
+  - The history table keeps the last accesses of each IP: line and cycle.
+  - The in-flight table keeps the cycle each demand miss and L2 prefetch was
+    issued; l2_cache_fill() turns that into the fill latency.
+  - When a demand miss is filled, or a demand hits a prefetched line, the
+    IP's history is searched for accesses at least one fill latency before
+    the demand.  The delta from each of those to the demanded line would
+    have been timely, and is counted in the IP's delta table.
+  - After SEARCHES_PER_ROUND searches, each delta's coverage (count per
+    search) picks its status: at least L2_COVERAGE prefetches into the L2,
+    at least LLC_COVERAGE into the LLC, below that nothing.  The counts then
+    start over, but the statuses stay until the next round.
+
+  For prefetched lines, the fill latency is kept per L2 block until the
+  first demand hit, since the hit itself takes no time to measure.
+
+  Storage, in bits:
+    history     8 sets x 16 ways x (7 IP tag + 24 line + 16 cycle)          6016
+    in-flight  64 x (24 line + 16 cycle + 7 IP tag + 1 demand)               3072
+    deltas     64 IPs x (10 IP tag + 4 searches + 6 LRU + 16 x (7 delta
+                         + 4 count + 2 status))                          14592
+    latencies 256 sets x 8 ways x 12 latency                              24576
+    total                                                                48256 (5.9 KB)
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "../inc/prefetcher.h"
+
+#define HISTORY_SETS 8
+#define HISTORY_WAYS 16
+#define IN_FLIGHT_COUNT 64
+#define DELTA_TABLE_COUNT 64
+#define DELTAS_PER_IP 16
+
+#define SEARCHES_PER_ROUND 16
+// coverage thresholds, in counts out of SEARCHES_PER_ROUND
+#define L2_COVERAGE 10
+#define LLC_COVERAGE 5
+// at most this many timely deltas are counted per search
+#define DELTAS_PER_SEARCH 8
+#define MAX_PREFETCHES 12
+#define LATENCY_MAX 4095
+
+enum delta_status { STATUS_NONE, STATUS_LLC, STATUS_L2 };
+
+typedef struct history_entry
+{
+	unsigned long long int ip;
+	unsigned long long int line;
+	unsigned long long int cycle;
+	int valid;
+} history_entry_t;
+
+typedef struct in_flight_entry
+{
+	unsigned long long int line;
+	unsigned long long int cycle;
+	// for demand misses, and prefetches a demand merged into: the IP and cycle of the demand
+	int demand;
+	unsigned long long int ip;
+	unsigned long long int demand_cycle;
+	int valid;
+} in_flight_entry_t;
+
+typedef struct delta_entry
+{
+	int delta;
+	int count;
+	int status;
+} delta_entry_t;
+
+typedef struct ip_deltas
+{
+	unsigned long long int ip;
+	int searches;
+	delta_entry_t deltas[DELTAS_PER_IP];
+	// used for IP replacement
+	unsigned long long int lru_cycle;
+	int valid;
+} ip_deltas_t;
+
+history_entry_t history[HISTORY_SETS][HISTORY_WAYS];
+// next way to replace in each history set
+int history_next[HISTORY_SETS];
+in_flight_entry_t in_flight[IN_FLIGHT_COUNT];
+ip_deltas_t delta_table[DELTA_TABLE_COUNT];
+// fill latency of a prefetched L2 block, 0 once it has been used or if it was not prefetched
+int prefetch_latency[L2_SET_COUNT][L2_ASSOCIATIVITY];
+
+unsigned long long int l2_prefetches, llc_prefetches, timely_searches, latency_samples, latency_total;
+
+int history_set(unsigned long long int ip)
+{
+	return (ip ^ (ip >> 3) ^ (ip >> 7)) & (HISTORY_SETS - 1);
+}
+
+void history_add(unsigned long long int ip, unsigned long long int line, unsigned long long int cycle)
+{
+	int s = history_set(ip);
+	history_entry_t *h = &history[s][history_next[s]];
+	history_next[s] = (history_next[s] + 1) % HISTORY_WAYS;
+	h->ip = ip;
+	h->line = line;
+	h->cycle = cycle;
+	h->valid = 1;
+}
+
+ip_deltas_t *delta_table_find(unsigned long long int ip, int allocate)
+{
+	int i, victim = 0;
+	for (i = 0; i < DELTA_TABLE_COUNT; i++) {
+		if (delta_table[i].valid && delta_table[i].ip == ip) {
+			delta_table[i].lru_cycle = get_current_cycle(0);
+			return &delta_table[i];
+		}
+		if (!delta_table[i].valid || delta_table[i].lru_cycle < delta_table[victim].lru_cycle)
+			victim = i;
+	}
+	if (!allocate)
+		return NULL;
+
+	// many IPs miss now and then, so the busy ones must not be replaced by each of those
+	ip_deltas_t *d = &delta_table[victim];
+	memset(d, 0, sizeof(*d));
+	d->ip = ip;
+	d->lru_cycle = get_current_cycle(0);
+	d->valid = 1;
+	return d;
+}
+
+void count_delta(ip_deltas_t *d, int delta)
+{
+	int i, victim = -1;
+	for (i = 0; i < DELTAS_PER_IP; i++) {
+		delta_entry_t *e = &d->deltas[i];
+		if ((e->count > 0 || e->status != STATUS_NONE) && e->delta == delta) {
+			e->count++;
+			return;
+		}
+		// a prefetching delta keeps its slot until the end of the round judges it
+		if (victim == -1 && e->count == 0 && e->status == STATUS_NONE)
+			victim = i;
+	}
+	if (victim != -1) {
+		d->deltas[victim].delta = delta;
+		d->deltas[victim].count = 1;
+	}
+}
+
+// Counts the deltas from the IP's earlier accesses that would have covered a demand for line at
+// demand_cycle, given a fill latency.
+void learn(unsigned long long int ip, unsigned long long int line, unsigned long long int demand_cycle, int latency)
+{
+	ip_deltas_t *d = delta_table_find(ip, 1);
+	int s = history_set(ip);
+	int i, found = 0;
+
+	latency_samples++;
+	latency_total += latency;
+
+	// newest first, so the shortest timely deltas are counted
+	for (i = 1; i <= HISTORY_WAYS && found < DELTAS_PER_SEARCH; i++) {
+		history_entry_t *h = &history[s][(history_next[s] - i + HISTORY_WAYS) % HISTORY_WAYS];
+		if (!h->valid || h->ip != ip || h->cycle + latency > demand_cycle)
+			continue;
+		long long int delta = (long long int)line - (long long int)h->line;
+		if (delta == 0 || delta >= 64 || delta <= -64)
+			continue;
+		count_delta(d, delta);
+		found++;
+	}
+	if (found)
+		timely_searches++;
+
+	if (++d->searches >= SEARCHES_PER_ROUND) {
+		for (i = 0; i < DELTAS_PER_IP; i++) {
+			delta_entry_t *e = &d->deltas[i];
+			if (e->count >= L2_COVERAGE)
+				e->status = STATUS_L2;
+			else if (e->count >= LLC_COVERAGE)
+				e->status = STATUS_LLC;
+			else
+				e->status = STATUS_NONE;
+			e->count = 0;
+		}
+		d->searches = 0;
+	}
+}
+
+in_flight_entry_t *in_flight_find(unsigned long long int line)
+{
+	int i;
+	for (i = 0; i < IN_FLIGHT_COUNT; i++)
+		if (in_flight[i].valid && in_flight[i].line == line)
+			return &in_flight[i];
+	return NULL;
+}
+
+in_flight_entry_t *in_flight_add(unsigned long long int line, unsigned long long int cycle)
+{
+	// replace a free or else the oldest entry; entries whose fill never came age out
+	int i, victim = 0;
+	for (i = 0; i < IN_FLIGHT_COUNT; i++) {
+		if (!in_flight[i].valid) {
+			victim = i;
+			break;
+		}
+		if (in_flight[i].cycle < in_flight[victim].cycle)
+			victim = i;
+	}
+	in_flight_entry_t *e = &in_flight[victim];
+	memset(e, 0, sizeof(*e));
+	e->line = line;
+	e->cycle = cycle;
+	e->valid = 1;
+	return e;
+}
+
+void l2_prefetcher_initialize(int cpu_num)
+{
+	printf("Berti Prefetcher\n");
+	// you can inspect these knob values from your code to see which configuration you're runnig in
+	printf("Knobs visible from prefetcher: %d %d %d\n", knob_scramble_loads, knob_small_llc, knob_low_bandwidth);
+
+	memset(history, 0, sizeof(history));
+	memset(history_next, 0, sizeof(history_next));
+	memset(in_flight, 0, sizeof(in_flight));
+	memset(delta_table, 0, sizeof(delta_table));
+	memset(prefetch_latency, 0, sizeof(prefetch_latency));
+	l2_prefetches = llc_prefetches = timely_searches = latency_samples = latency_total = 0;
+}
+
+void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned long long int ip, int cache_hit)
+{
+	// uncomment this line to see all the information available to make prefetch decisions
+	// printf("(%lld 0x%llx 0x%llx %d %d %d) ", get_current_cycle(0), addr, ip, cache_hit, get_l2_read_queue_occupancy(0), get_l2_mshr_occupancy(0));
+
+	unsigned long long int cl_address = addr >> 6;
+	unsigned long long int cycle = get_current_cycle(0);
+
+	if (cache_hit) {
+		// the first hit on a prefetched block learns from the latency of its prefetch
+		int s = l2_get_set(addr);
+		int w = l2_get_way(0, addr, s);
+		if (w >= 0 && prefetch_latency[s][w]) {
+			learn(ip, cl_address, cycle, prefetch_latency[s][w]);
+			prefetch_latency[s][w] = 0;
+		}
+	}
+	else {
+		// learn once the fill arrives; a demand for a line being prefetched waits for that prefetch
+		in_flight_entry_t *e = in_flight_find(cl_address);
+		if (e == NULL)
+			e = in_flight_add(cl_address, cycle);
+		if (!e->demand) {
+			e->demand = 1;
+			e->ip = ip;
+			e->demand_cycle = cycle;
+		}
+	}
+	history_add(ip, cl_address, cycle);
+
+	ip_deltas_t *d = delta_table_find(ip, 0);
+	if (d == NULL)
+		return;
+
+	int i, issued = 0;
+	for (i = 0; i < DELTAS_PER_IP && issued < MAX_PREFETCHES; i++) {
+		delta_entry_t *e = &d->deltas[i];
+		if (e->status == STATUS_NONE)
+			continue;
+		unsigned long long int pf_line = cl_address + e->delta;
+		if ((pf_line >> 6) != (cl_address >> 6) || in_flight_find(pf_line) != NULL)
+			continue;
+
+		// L2 prefetches need an MSHR, so with few left they go to the LLC as well
+		int fill_level = (e->status == STATUS_L2 && get_l2_mshr_occupancy(0) < L2_MSHR_COUNT - 4) ? FILL_L2 : FILL_LLC;
+		if (!l2_prefetch_line(0, addr, pf_line << 6, fill_level))
+			continue;
+		issued++;
+		if (fill_level == FILL_L2) {
+			in_flight_add(pf_line, cycle);
+			l2_prefetches++;
+		}
+		else
+			llc_prefetches++;
+	}
+}
+
+void l2_cache_fill(int cpu_num, unsigned long long int addr, int set, int way, int prefetch, unsigned long long int evicted_addr)
+{
+	// uncomment this line to see the information available to you when there is a cache fill event
+	// printf("0x%llx %d %d %d 0x%llx\n", addr, set, way, prefetch, evicted_addr);
+
+	prefetch_latency[set][way] = 0;
+	in_flight_entry_t *e = in_flight_find(addr >> 6);
+	if (e == NULL)
+		return;
+
+	unsigned long long int latency = get_current_cycle(0) - e->cycle;
+	if (latency > LATENCY_MAX)
+		latency = LATENCY_MAX;
+	if (latency == 0)
+		latency = 1;
+
+	if (e->demand)
+		learn(e->ip, e->line, e->demand_cycle, latency);
+	else
+		prefetch_latency[set][way] = latency;
+	e->valid = 0;
+}
+
+void l2_prefetcher_heartbeat_stats(int cpu_num)
+{
+	printf("Prefetcher heartbeat stats\n");
+}
+
+void l2_prefetcher_warmup_stats(int cpu_num)
+{
+	printf("Prefetcher warmup complete stats\n\n");
+	l2_prefetches = llc_prefetches = timely_searches = latency_samples = latency_total = 0;
+}
+
+void l2_prefetcher_final_stats(int cpu_num)
+{
+	printf("Prefetcher final stats\n");
+	printf("L2 prefetches: %llu LLC prefetches: %llu\n", l2_prefetches, llc_prefetches);
+	printf("Searches with timely deltas: %llu of %llu, average fill latency: %.1f cycles\n", timely_searches, latency_samples,
+	       latency_samples ? (double)latency_total / latency_samples : 0.0);
+}
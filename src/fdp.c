@@ -7,17 +7,63 @@
 
   FDP prefetcher
 
+  Besides the FDP accuracy/lateness/pollution feedback, the prefetcher keeps
+  log2-scale timeliness histograms, printed with the final stats:
+  - L2 fill to first use: cycles between a prefetch fill and the first
+    demand hit on that line.
+  - L2 late wait: cycles a demand miss waited for an in-flight prefetch.
+  - L2 unused lifetime: cycles a prefetched line lived in the L2 before it
+    was evicted without ever being used.
+  - LLC issue to use: cycles between issuing an LLC prefetch and the first
+    L2 demand miss to that line (LLC fills are not visible to the prefetcher).
+
+  Accuracy and lateness are also tracked per stream, so each stream gets
+  its own aggressiveness level (prefetch degree and stream window): the
+  L2-wide level, which pollution can only be measured for, lowered by one
+  for a stream of medium accuracy and by two for one of low accuracy, or
+  raised by one for an accurate stream that is late.  Streams need an
+  average of MIN_STREAM_PREFETCHES prefetches per interval before their own
+  feedback counts.  Prefetches are credited to the stream that issued them,
+  and a stream keeps its feedback as it runs from one page into the next.
+  A stream that reaches the end of its page leaves a pending entry for the
+  instruction driving it, so when that instruction's first access to a new
+  page lands near the start of the page in the stream's direction,
+  prefetching resumes at the stream's degree instead of training from zero.
+  Pending entries are matched by IP rather than by the adjacent page,
+  because the L2 sees physical addresses.
+  An interval ends after T_INTERVAL L2 evictions or T_INTERVAL_CYCLES
+  cycles, whichever comes first, so settings do not go stale in phases with
+  few misses.
+
+  Set DPC2_EVENT_TRACE_START to record the prefetcher's memory requests in a
+  Chrome trace; see inc/event_trace.h.
+
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include "../inc/prefetcher.h"
+#include "../inc/event_trace.h"
 
 #define STREAM_DETECTOR_COUNT 64
+// more than the detectors and pending entries can refer to, so one slot is always free to recycle
+#define STREAM_COUNT 128
+// credits a prefetch to no stream, after its stream's slot was recycled
+#define STREAM_NONE -1
+#define PENDING_STREAM_COUNT 16
+// a stream hands off once it is accessed within PENDING_EDGE lines of the end of its page
+#define PENDING_EDGE 4
+// and the next page continues it if first accessed within PENDING_REACH lines of its start
+#define PENDING_REACH 8
 
 
  // Parameters
 #define T_INTERVAL 512
+#define T_INTERVAL_CYCLES 250000
+#define MIN_STREAM_PREFETCHES 4
+// a few late prefetches already make one stream look late, so its lateness counts only above this
+#define STREAM_T_LAT 0.1
 #define PREFETCH_EVICT_SIZE 4096
 #define A_HIGH 0.75
 #define A_LOW 0.40
@@ -26,6 +72,9 @@
 
 // #define DEBUG
 
+// bucket 0 counts zero cycles, bucket i counts [2^(i-1), 2^i) cycles
+#define HISTOGRAM_BUCKETS 32
+
 
 #define MSHR_SIZE 2048
 int useful_bit[L2_SET_COUNT][L2_ASSOCIATIVITY];
@@ -41,7 +90,58 @@ int used_cnt, prefetch_cnt, late_cnt, miss_cnt, miss_prefetch_cnt, evict_cnt;
 // Values global
 float used_total, prefetch_total, late_total, miss_total, miss_prefetch_total;
 
-int prefetch_degree, stream_window, aggressive_level;
+// L2-wide aggressiveness, for streams with too little feedback of their own
+int aggressive_level;
+// cycle at which the current interval began
+unsigned long long int interval_start_cycle;
+
+// Timeliness tracking
+int prefetch_unused[L2_SET_COUNT][L2_ASSOCIATIVITY];
+unsigned long long int prefetch_fill_cycle[L2_SET_COUNT][L2_ASSOCIATIVITY];
+// cycle at which a demand started waiting for the prefetch in this mshr entry, 0 if none
+unsigned long long int late_wait_start[MSHR_SIZE];
+// LLC prefetches, indexed like prefetch_evict; llc_prefetch_addr stores addr >> 6
+unsigned long long int llc_prefetch_addr[PREFETCH_EVICT_SIZE];
+unsigned long long int llc_prefetch_cycle[PREFETCH_EVICT_SIZE];
+
+unsigned long long int fill_to_use_hist[HISTOGRAM_BUCKETS];
+unsigned long long int late_wait_hist[HISTOGRAM_BUCKETS];
+unsigned long long int unused_lifetime_hist[HISTOGRAM_BUCKETS];
+unsigned long long int llc_issue_to_use_hist[HISTOGRAM_BUCKETS];
+
+void histogram_add(unsigned long long int *hist, unsigned long long int cycles)
+{
+	int bucket = 0;
+	while (cycles != 0 && bucket < HISTOGRAM_BUCKETS - 1) {
+		cycles >>= 1;
+		bucket++;
+	}
+	hist[bucket]++;
+}
+
+void histogram_print(const char *name, unsigned long long int *hist)
+{
+	unsigned long long int total = 0;
+	int i;
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+		total += hist[i];
+
+	printf("%s (%llu samples)\n", name, total);
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		if (hist[i] == 0)
+			continue;
+		unsigned long long int low = (i == 0) ? 0 : (1ULL << (i - 1));
+		printf("  [%llu, %llu): %llu (%.2f%%)\n", low, 1ULL << i, hist[i], 100.0 * hist[i] / total);
+	}
+}
+
+void histogram_reset()
+{
+	memset(fill_to_use_hist, 0, sizeof(fill_to_use_hist));
+	memset(late_wait_hist, 0, sizeof(late_wait_hist));
+	memset(unused_lifetime_hist, 0, sizeof(unused_lifetime_hist));
+	memset(llc_issue_to_use_hist, 0, sizeof(llc_issue_to_use_hist));
+}
 
 
 typedef struct stream_detector
@@ -57,11 +157,139 @@ typedef struct stream_detector
 
 	// cache line index within the page where prefetches will be issued
 	int pf_index;
+
+	// the stream this page is part of, an index into streams[]
+	int stream;
+
+	// set when this detector took its stream over from the previous page
+	int continued;
 } stream_detector_t;
 
 stream_detector_t detectors[STREAM_DETECTOR_COUNT];
 int replacement_index;
 
+typedef struct pending_stream
+{
+	// the instruction driving the stream, 0 if this entry is free
+	unsigned long long int ip;
+
+	// what the stream hands to its next page's detector
+	int direction;
+	int confidence;
+	int stream;
+} pending_stream_t;
+
+pending_stream_t pending[PENDING_STREAM_COUNT];
+int pending_replacement_index;
+
+// A stream spans the pages it runs through, so its feedback outlives their detectors.
+typedef struct stream_feedback
+{
+	// this stream's aggressiveness, 1-5, and the settings it stands for
+	int aggressive_level;
+	int stream_window;
+	int prefetch_degree;
+
+	// this stream's feedback, in the current interval and averaged over past ones
+	int used_cnt, prefetch_cnt, late_cnt;
+	float used_total, prefetch_total, late_total;
+} stream_feedback_t;
+
+stream_feedback_t streams[STREAM_COUNT];
+int next_stream;
+// the stream that prefetched the line in each mshr entry and L2 block, or STREAM_NONE
+int mshr_stream[MSHR_SIZE];
+int useful_stream[L2_SET_COUNT][L2_ASSOCIATIVITY];
+
+void set_aggressive_level(stream_feedback_t *d, int level)
+{
+	if (level > 5)
+		level = 5;
+	if (level < 1)
+		level = 1;
+	d->aggressive_level = level;
+
+	switch (level) {
+	case 1:
+		d->stream_window = 4;
+		d->prefetch_degree = 1;
+		break;
+	case 2:
+		d->stream_window = 8;
+		d->prefetch_degree = 1;
+		break;
+	case 3:
+		d->stream_window = 16;
+		d->prefetch_degree = 2;
+		break;
+	case 4:
+		d->stream_window = 32;
+		d->prefetch_degree = 4;
+		break;
+	case 5:
+		d->stream_window = 64;
+		d->prefetch_degree = 4;
+	}
+}
+
+void reset_stream_feedback(stream_feedback_t *d)
+{
+	d->used_cnt = 0;
+	d->prefetch_cnt = 0;
+	d->late_cnt = 0;
+	d->used_total = 0;
+	d->prefetch_total = 0;
+	d->late_total = 0;
+}
+
+// Returns the slot for a new stream starting in the page of detectors[detector_index].  Slots
+// that nothing refers to any more come first.  Otherwise, a slot that only prefetched lines
+// still refer to is taken, and those lines are no longer credited to any stream, so that
+// they do not count as feedback for the new one.
+int allocate_stream(int detector_index)
+{
+	int live[STREAM_COUNT] = { 0 };
+	int credited[STREAM_COUNT] = { 0 };
+	int i, j, stream = -1;
+
+	for (i = 0; i < STREAM_DETECTOR_COUNT; i++)
+		if (i != detector_index)
+			live[detectors[i].stream] = 1;
+	for (i = 0; i < PENDING_STREAM_COUNT; i++)
+		if (pending[i].ip != 0)
+			live[pending[i].stream] = 1;
+	for (i = 0; i < MSHR_SIZE; i++)
+		if (mshr_valid[i] && mshr_stream[i] != STREAM_NONE)
+			credited[mshr_stream[i]] = 1;
+	for (i = 0; i < L2_SET_COUNT; i++)
+		for (j = 0; j < L2_ASSOCIATIVITY; j++)
+			if (useful_bit[i][j] && useful_stream[i][j] != STREAM_NONE)
+				credited[useful_stream[i][j]] = 1;
+
+	for (i = 0; i < STREAM_COUNT && stream == -1; i++)
+		if (!live[(next_stream + i) % STREAM_COUNT] && !credited[(next_stream + i) % STREAM_COUNT])
+			stream = (next_stream + i) % STREAM_COUNT;
+	for (i = 0; i < STREAM_COUNT && stream == -1; i++)
+		if (!live[(next_stream + i) % STREAM_COUNT])
+			stream = (next_stream + i) % STREAM_COUNT;
+	assert(stream != -1);
+
+	if (credited[stream]) {
+		for (i = 0; i < MSHR_SIZE; i++)
+			if (mshr_stream[i] == stream)
+				mshr_stream[i] = STREAM_NONE;
+		for (i = 0; i < L2_SET_COUNT; i++)
+			for (j = 0; j < L2_ASSOCIATIVITY; j++)
+				if (useful_stream[i][j] == stream)
+					useful_stream[i][j] = STREAM_NONE;
+	}
+
+	next_stream = (stream + 1) % STREAM_COUNT;
+	set_aggressive_level(&streams[stream], aggressive_level);
+	reset_stream_feedback(&streams[stream]);
+	return stream;
+}
+
 void l2_prefetcher_initialize(int cpu_num)
 {
 	printf("FDP Prefetcher\n");
@@ -75,7 +303,21 @@ void l2_prefetcher_initialize(int cpu_num)
 		detectors[i].direction = 0;
 		detectors[i].confidence = 0;
 		detectors[i].pf_index = -1;
+		detectors[i].stream = i;
+		detectors[i].continued = 0;
+	}
+	for (i = 0; i < STREAM_COUNT; i++) {
+		set_aggressive_level(&streams[i], 3);
+		reset_stream_feedback(&streams[i]);
 	}
+	next_stream = 0;
+	for (i = 0; i < PENDING_STREAM_COUNT; i++) {
+		pending[i].ip = 0;
+		pending[i].direction = 0;
+		pending[i].confidence = 0;
+		pending[i].stream = 0;
+	}
+	pending_replacement_index = 0;
 
 	replacement_index = 0;
 	used_total = 0;
@@ -91,20 +333,166 @@ void l2_prefetcher_initialize(int cpu_num)
 	miss_prefetch_cnt = 0;
 	evict_cnt = 0;
 
-	// Initial configuration
-	stream_window = 16;
-	prefetch_degree = 2;
 	aggressive_level = 3;
+	interval_start_cycle = 0;
 
 	for (i = 0; i < L2_SET_COUNT; i++)
-		for (j = 0; j < L2_ASSOCIATIVITY; j++)
+		for (j = 0; j < L2_ASSOCIATIVITY; j++) {
 			useful_bit[i][j] = 0;
+			useful_stream[i][j] = 0;
+			prefetch_unused[i][j] = 0;
+		}
 	for (i = 0; i < MSHR_SIZE; i++) {
 		late_bit[i] = 0;
 		mshr_valid[i] = 0;
+		mshr_stream[i] = 0;
+		late_wait_start[i] = 0;
 	}
-	for (i = 0; i < PREFETCH_EVICT_SIZE; i++)
+	for (i = 0; i < PREFETCH_EVICT_SIZE; i++) {
 		prefetch_evict[i] = 0;
+		llc_prefetch_addr[i] = 0;
+	}
+	histogram_reset();
+	event_trace_initialize();
+}
+
+// Returns how to change an aggressiveness level, -1, 0 or +1, for the given feedback.
+int update_rule(float acc, float lat, float pol)
+{
+	// acc_level: 0-Low, 1-Medium, 2-High
+	// lat_level: 0-Not_late, 1-Late
+	// pol_level: 0-Low, 1-High
+	int acc_level, lat_level, pol_level;
+	if (acc < A_LOW)
+		acc_level = 0;
+	else if (acc < A_HIGH)
+		acc_level = 1;
+	else
+		acc_level = 2;
+	lat_level = (lat < T_LAT) ? 0 : 1;
+	pol_level = (pol < T_POL) ? 0 : 1;
+
+	// Update Rule
+	int update_rule = 0;
+	switch (acc_level) {
+	case 0:
+		if (lat_level) {
+			update_rule = -1;
+		}
+		else {
+			update_rule = (pol_level) ? -1 : 0;
+		}
+		break;
+	case 1:
+		if (lat_level) {
+			update_rule = (pol_level) ? -1 : 1;
+		}
+		else {
+			update_rule = (pol_level) ? -1 : 0;
+		}
+		break;
+	case 2:
+		if (lat_level) {
+			update_rule = 1;
+		}
+		else {
+			update_rule = (pol_level) ? -1 : 0;
+		}
+	}
+	return update_rule;
+}
+
+void end_interval()
+{
+	evict_cnt = 0;
+	interval_start_cycle = get_current_cycle(0);
+
+	int j;
+	for (j = 0; j < MSHR_SIZE; j++)
+		if (mshr_valid[j]) {
+			prefetch_cnt++;
+			if (mshr_stream[j] != STREAM_NONE)
+				streams[mshr_stream[j]].prefetch_cnt++;
+		}
+	if (prefetch_cnt < used_cnt)
+		prefetch_cnt = used_cnt;
+
+	printf("Count: %d %d %d %d %d\n", used_cnt, prefetch_cnt, late_cnt, miss_cnt, miss_prefetch_cnt);
+
+	const float alpha = 0.5;
+
+	used_total = alpha * used_total + (1 - alpha) * used_cnt;
+	prefetch_total = alpha * prefetch_total + (1 - alpha) * prefetch_cnt;
+	late_total = alpha * late_total + (1 - alpha) * late_cnt;
+	miss_total = alpha * miss_total + (1 - alpha) * miss_cnt;
+	miss_prefetch_total = alpha * miss_prefetch_total + (1 - alpha) * miss_prefetch_cnt;
+
+	const float eps = 1e-3;
+	if (used_total < eps)
+		used_total = 0;
+	if (prefetch_total < eps)
+		prefetch_total = 0;
+	if (late_total < eps)
+		late_total = 0;
+	if (miss_total < eps)
+		miss_total = 0;
+	if (miss_prefetch_total < eps)
+		miss_prefetch_total = 0;
+
+	used_cnt = 0;
+	prefetch_cnt = 0;
+	late_cnt = 0;
+	miss_cnt = 0;
+	miss_prefetch_cnt = 0;
+
+
+	float acc = (prefetch_total == 0) ? 0 : (used_total / prefetch_total);
+	float lat = (used_total == 0) ? 0 : (late_total / used_total);
+	float pol = (miss_total == 0) ? 0 : (miss_prefetch_total / miss_total);
+
+	printf("Metric: acc %f  lat %f  pol %f\n", acc, lat, pol);
+
+	aggressive_level += update_rule(acc, lat, pol);
+	if (aggressive_level > 5)
+		aggressive_level = 5;
+	if (aggressive_level < 1)
+		aggressive_level = 1;
+
+	printf("Aggressive level: %d\n\n", aggressive_level);
+
+	// Each stream with enough feedback follows its own accuracy and lateness
+	for (j = 0; j < STREAM_COUNT; j++) {
+		stream_feedback_t *d = &streams[j];
+		if (d->prefetch_cnt < d->used_cnt)
+			d->prefetch_cnt = d->used_cnt;
+
+		d->used_total = alpha * d->used_total + (1 - alpha) * d->used_cnt;
+		d->prefetch_total = alpha * d->prefetch_total + (1 - alpha) * d->prefetch_cnt;
+		d->late_total = alpha * d->late_total + (1 - alpha) * d->late_cnt;
+		if (d->used_total < eps)
+			d->used_total = 0;
+		if (d->prefetch_total < eps)
+			d->prefetch_total = 0;
+		if (d->late_total < eps)
+			d->late_total = 0;
+
+		d->used_cnt = 0;
+		d->prefetch_cnt = 0;
+		d->late_cnt = 0;
+
+		int offset = 0;
+		if (d->prefetch_total >= MIN_STREAM_PREFETCHES) {
+			float d_acc = d->used_total / d->prefetch_total;
+			float d_lat = (d->used_total == 0) ? 0 : (d->late_total / d->used_total);
+			if (d_acc < A_LOW)
+				offset = -2;
+			else if (d_acc < A_HIGH)
+				offset = -1;
+			else if (d_lat >= STREAM_T_LAT)
+				offset = 1;
+		}
+		set_aggressive_level(d, aggressive_level + offset);
+	}
 }
 
 void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned long long int ip, int cache_hit)
@@ -119,6 +507,12 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
 	unsigned long long int a1 = (cl_address >> 12) & 0xfff;
 	unsigned long long int virt_addr = a0 ^ a1;
 
+	event_trace_demand(addr, cache_hit);
+
+	// Phases with few evictions still get fresh feedback
+	if (get_current_cycle(0) - interval_start_cycle >= T_INTERVAL_CYCLES)
+		end_interval();
+
 	if (cache_hit) {
 		// Check pref-bit for usefulness
 		int s = l2_get_set(addr);
@@ -129,8 +523,14 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
 		if (useful_bit[s][w]) {
 			used_cnt++;
 			useful_bit[s][w] = 0;
+			if (useful_stream[s][w] != STREAM_NONE)
+				streams[useful_stream[s][w]].used_cnt++;
 		}
 
+		if (prefetch_unused[s][w]) {
+			histogram_add(fill_to_use_hist, get_current_cycle(0) - prefetch_fill_cycle[s][w]);
+			prefetch_unused[s][w] = 0;
+		}
 
 	}
 	else {
@@ -149,12 +549,23 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
 				late_cnt++;
 				used_cnt++;
 				late_bit[mshr_index] = 0;
+				if (mshr_stream[mshr_index] != STREAM_NONE) {
+					streams[mshr_stream[mshr_index]].late_cnt++;
+					streams[mshr_stream[mshr_index]].used_cnt++;
+				}
+				late_wait_start[mshr_index] = get_current_cycle(0);
 			}
 		}
 
 		// Check for cache pollution
 		if (prefetch_evict[virt_addr])
 			miss_prefetch_cnt++;
+
+		// Check for a use of an LLC prefetch
+		if (llc_prefetch_addr[virt_addr] == cl_address) {
+			histogram_add(llc_issue_to_use_hist, get_current_cycle(0) - llc_prefetch_cycle[virt_addr]);
+			llc_prefetch_addr[virt_addr] = 0;
+		}
 	}
 
 
@@ -192,13 +603,40 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
 		detectors[detector_index].direction = 0;
 		detectors[detector_index].confidence = 0;
 		detectors[detector_index].pf_index = page_offset;
+		detectors[detector_index].continued = 0;
+
+		// a stream running into this page from a neighboring one continues; otherwise a new stream begins
+		int stream = -1;
+		for (i = 0; i < STREAM_DETECTOR_COUNT; i++)
+			if (i != detector_index && detectors[i].confidence >= 2 &&
+			    detectors[i].page + detectors[i].direction == page)
+				stream = detectors[i].stream;
+		// one this instruction ran off the end of its last page resumes here without retraining
+		for (i = 0; i < PENDING_STREAM_COUNT; i++)
+			if (pending[i].ip == ip &&
+			    ((pending[i].direction == 1 && page_offset < PENDING_REACH) ||
+			     (pending[i].direction == -1 && page_offset > 63 - PENDING_REACH))) {
+				detectors[detector_index].direction = pending[i].direction;
+				detectors[detector_index].confidence = pending[i].confidence;
+				detectors[detector_index].continued = 1;
+				stream = pending[i].stream;
+				pending[i].ip = 0;
+				break;
+			}
+		if (stream == -1)
+			stream = allocate_stream(detector_index);
+		detectors[detector_index].stream = stream;
 	}
 
+	// demands trailing the prefetches of a continued stream are no reason to retrain it
+	int trailing = detectors[detector_index].continued &&
+		((page_offset - detectors[detector_index].pf_index) * detectors[detector_index].direction < 0);
+
 	// train on the new access
-	if (page_offset > detectors[detector_index].pf_index)
+	if (!trailing && page_offset > detectors[detector_index].pf_index)
 	{
 		// accesses outside the stream_window do not train the detector
-		if ((page_offset - detectors[detector_index].pf_index) < stream_window)
+		if ((page_offset - detectors[detector_index].pf_index) < streams[detectors[detector_index].stream].stream_window)
 		{
 			if (detectors[detector_index].direction == -1)
 			{
@@ -214,10 +652,10 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
 			detectors[detector_index].direction = 1;
 		}
 	}
-	else if (page_offset < detectors[detector_index].pf_index)
+	else if (!trailing && page_offset < detectors[detector_index].pf_index)
 	{
 		// accesses outside the stream_window do not train the detector
-		if ((detectors[detector_index].pf_index - page_offset) < stream_window)
+		if ((detectors[detector_index].pf_index - page_offset) < streams[detectors[detector_index].stream].stream_window)
 		{
 			if (detectors[detector_index].direction == 1)
 			{
@@ -237,8 +675,30 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
 	// prefetch if confidence is high enough
 	if (detectors[detector_index].confidence >= 2)
 	{
+		// near the end of the page, get ready to hand the stream to the next one
+		if ((detectors[detector_index].direction == 1 && page_offset >= 64 - PENDING_EDGE) ||
+		    (detectors[detector_index].direction == -1 && page_offset < PENDING_EDGE))
+		{
+			int pending_index = -1;
+			for (i = 0; i < PENDING_STREAM_COUNT; i++)
+				if (pending[i].ip == ip) {
+					pending_index = i;
+					break;
+				}
+			if (pending_index == -1) {
+				pending_index = pending_replacement_index;
+				pending_replacement_index = (pending_replacement_index + 1) % PENDING_STREAM_COUNT;
+			}
+
+			pending_stream_t *p = &pending[pending_index];
+			p->ip = ip;
+			p->direction = detectors[detector_index].direction;
+			p->confidence = detectors[detector_index].confidence;
+			p->stream = detectors[detector_index].stream;
+		}
+
 		int i;
-		for (i = 0; i < prefetch_degree; i++)
+		for (i = 0; i < streams[detectors[detector_index].stream].prefetch_degree; i++)
 		{
 			detectors[detector_index].pf_index += detectors[detector_index].direction;
 
@@ -255,7 +715,14 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
 			if (get_l2_mshr_occupancy(0) > 8)
 			{
 				// conservatively prefetch into the LLC, because MSHRs are scarce
-				l2_prefetch_line(0, addr, pf_address, FILL_LLC);
+				int issued = l2_prefetch_line(0, addr, pf_address, FILL_LLC);
+				event_trace_prefetch(pf_address, FILL_LLC, issued);
+				if (issued) {
+					unsigned long long int pf_cl_address = pf_address >> 6;
+					int llc_index = (pf_cl_address & 0xfff) ^ ((pf_cl_address >> 12) & 0xfff);
+					llc_prefetch_addr[llc_index] = pf_cl_address;
+					llc_prefetch_cycle[llc_index] = get_current_cycle(0);
+				}
 			}
 			else
 			{
@@ -266,7 +733,7 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
 				int w = l2_get_way(0, pf_address, s);
 
 
-				l2_prefetch_line(0, addr, pf_address, FILL_L2);
+				event_trace_prefetch(pf_address, FILL_L2, l2_prefetch_line(0, addr, pf_address, FILL_L2));
 				if (w != -1)
 					continue;
 				// printf("\n%d\n", res);
@@ -291,6 +758,7 @@ void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned lo
 					mshr_valid[mshr_index] = 1;
 					mshr_addr[mshr_index] = pf_address >> 6;
 					late_bit[mshr_index] = 1;
+					mshr_stream[mshr_index] = detectors[detector_index].stream;
 				}
 
 #ifdef DEBUG
@@ -319,6 +787,15 @@ void l2_cache_fill(int cpu_num, unsigned long long int addr, int set, int way, i
 
 	if (evicted_addr != 0)
 		evict_cnt++;
+	event_trace_fill(addr, prefetch, evicted_addr);
+
+	// The line in this way is replaced, check whether it was an unused prefetch
+	unsigned long long int cycle = get_current_cycle(0);
+	if (prefetch_unused[set][way]) {
+		if (evicted_addr != 0)
+			histogram_add(unused_lifetime_hist, cycle - prefetch_fill_cycle[set][way]);
+		prefetch_unused[set][way] = 0;
+	}
 
 	// Virtual address
 	unsigned long long int cl_address = addr >> 6;
@@ -335,9 +812,17 @@ void l2_cache_fill(int cpu_num, unsigned long long int addr, int set, int way, i
 		mshr_index++;
 	}
 
+	int waited = 0;
 	if (mshr_index < MSHR_SIZE) {
 		// Set pref-bit for usefulness
 		useful_bit[set][way] = late_bit[mshr_index];
+		useful_stream[set][way] = mshr_stream[mshr_index];
+
+		if (late_wait_start[mshr_index]) {
+			histogram_add(late_wait_hist, cycle - late_wait_start[mshr_index]);
+			late_wait_start[mshr_index] = 0;
+			waited = 1;
+		}
 
 		mshr_valid[mshr_index] = 0;
 		late_bit[mshr_index] = 0;
@@ -346,6 +831,13 @@ void l2_cache_fill(int cpu_num, unsigned long long int addr, int set, int way, i
 	if (prefetch) {
 
 		prefetch_cnt++;
+		if (mshr_index < MSHR_SIZE && mshr_stream[mshr_index] != STREAM_NONE)
+			streams[mshr_stream[mshr_index]].prefetch_cnt++;
+		// A late demand already used this line
+		if (!waited) {
+			prefetch_unused[set][way] = 1;
+			prefetch_fill_cycle[set][way] = cycle;
+		}
 		// Add to evicted bit vector
 		if (evicted_addr != 0)
 			prefetch_evict[virt_addr] = 1;
@@ -364,124 +856,8 @@ void l2_cache_fill(int cpu_num, unsigned long long int addr, int set, int way, i
 
 
 	// Check interval
-	if (evict_cnt == T_INTERVAL) {
-		evict_cnt = 0;
-
-		int j;
-		for (j = 0; j < MSHR_SIZE; j++)
-			if (mshr_valid[j])
-				prefetch_cnt++;
-		if (prefetch_cnt < used_cnt)
-			prefetch_cnt = used_cnt;
-
-		printf("Count: %d %d %d %d %d\n", used_cnt, prefetch_cnt, late_cnt, miss_cnt, miss_prefetch_cnt);
-
-		const float alpha = 0.5;
-
-		used_total = alpha * used_total + (1 - alpha) * used_cnt;
-		prefetch_total = alpha * prefetch_total + (1 - alpha) * prefetch_cnt;
-		late_total = alpha * late_total + (1 - alpha) * late_cnt;
-		miss_total = alpha * miss_total + (1 - alpha) * miss_cnt;
-		miss_prefetch_total = alpha * miss_prefetch_total + (1 - alpha) * miss_prefetch_cnt;
-
-		const float eps = 1e-3;
-		if (used_total < eps)
-			used_total = 0;
-		if (prefetch_total < eps)
-			prefetch_total = 0;
-		if (late_total < eps)
-			late_total = 0;
-		if (miss_total < eps)
-			miss_total = 0;
-		if (miss_prefetch_total < eps)
-			miss_prefetch_total = 0;
-
-		used_cnt = 0;
-		prefetch_cnt = 0;
-		late_cnt = 0;
-		miss_cnt = 0;
-		miss_prefetch_cnt = 0;
-
-
-		float acc = (prefetch_total == 0) ? 0 : (used_total / prefetch_total);
-		float lat = (used_total == 0) ? 0 : (late_total / used_total);
-		float pol = (miss_total == 0) ? 0 : (miss_prefetch_total / miss_total);
-
-		printf("Metric: acc %f  lat %f  pol %f\n", acc, lat, pol);
-
-		// acc_level: 0-Low, 1-Medium, 2-High
-		// lat_level: 0-Not_late, 1-Late
-		// pol_level: 0-Low, 1-High
-		int acc_level, lat_level, pol_level;
-		if (acc < A_LOW)
-			acc_level = 0;
-		else if (acc < A_HIGH)
-			acc_level = 1;
-		else
-			acc_level = 2;
-		lat_level = (lat < T_LAT) ? 0 : 1;
-		pol_level = (pol < T_POL) ? 0 : 1;
-
-		// Update Rule
-		int update_rule;
-		switch (acc_level) {
-		case 0:
-			if (lat_level) {
-				update_rule = -1;
-			}
-			else {
-				update_rule = (pol_level) ? -1 : 0;
-			}
-			break;
-		case 1:
-			if (lat_level) {
-				update_rule = (pol_level) ? -1 : 1;
-			}
-			else {
-				update_rule = (pol_level) ? -1 : 0;
-			}
-			break;
-		case 2:
-			if (lat_level) {
-				update_rule = 1;
-			}
-			else {
-				update_rule = (pol_level) ? -1 : 0;
-			}
-		}
-
-		aggressive_level += update_rule;
-		if (aggressive_level > 5)
-			aggressive_level = 5;
-		if (aggressive_level < 1)
-			aggressive_level = 1;
-
-		printf("Aggressive level: %d\n\n", aggressive_level);
-
-		switch (aggressive_level) {
-		case 1:
-			stream_window = 4;
-			prefetch_degree = 1;
-			break;
-		case 2:
-			stream_window = 8;
-			prefetch_degree = 1;
-			break;
-		case 3:
-			stream_window = 16;
-			prefetch_degree = 2;
-			break;
-		case 4:
-			stream_window = 32;
-			prefetch_degree = 4;
-			break;
-		case 5:
-			stream_window = 64;
-			prefetch_degree = 4;
-		}
-
-
-	}
+	if (evict_cnt == T_INTERVAL)
+		end_interval();
 #ifdef DEBUG
 	// uncomment this line to see the information available to you when there is a cache fill event
 	printf("0x%llx %d %d %d 0x%llx\n", addr, set, way, prefetch, evicted_addr);
@@ -496,9 +872,15 @@ void l2_prefetcher_heartbeat_stats(int cpu_num)
 void l2_prefetcher_warmup_stats(int cpu_num)
 {
 	printf("Prefetcher warmup complete stats\n\n");
+	histogram_reset();
 }
 
 void l2_prefetcher_final_stats(int cpu_num)
 {
 	printf("Prefetcher final stats\n");
+	histogram_print("L2 prefetch fill to first use (cycles)", fill_to_use_hist);
+	histogram_print("L2 late prefetch demand wait (cycles)", late_wait_hist);
+	histogram_print("L2 unused prefetch lifetime at eviction (cycles)", unused_lifetime_hist);
+	histogram_print("LLC prefetch issue to first use (cycles)", llc_issue_to_use_hist);
+	event_trace_write();
 }
\ No newline at end of file
@@ -0,0 +1,417 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  IPCP prefetcher
+
+  Instruction Pointer Classifier-based Prefetching: every load IP is put in
+  one of three classes, each with its own prefetch pattern and degree.
+  - Global stream (GS): the IP touches regions that most other IPs also
+    sweep densely, in one direction.  Prefetches the next GS_DEGREE lines
+    in the stream's direction.
+  - Constant stride (CS): the IP keeps the same stride between its
+    accesses.  Prefetches CS_DEGREE strides ahead.
+  - Complex stride (CPLX): the IP's strides repeat as a sequence; a
+    signature of its recent strides indexes the Complex Stride Prediction
+    Table (CSPT), which predicts the next stride.  Prefetches CPLX_DEGREE
+    steps along the predicted strides.
+  IPs in none of the classes fall back to a next-line prefetch while the L2
+  MSHRs are not busy.  When an IP qualifies for several classes, GS wins
+  over CS, and CS over CPLX.
+
+  Regions are 2 KB.  The Region Stream Table (RST) keeps a bit vector of the
+  lines touched in the last RST_COUNT regions; a region with at least
+  RST_DENSE_LINES of its 32 lines touched is dense, and trains every IP that
+  touches it, or the region after it in the stream's direction, as GS.
+
+  Storage, in bits:
+    IP table   64 x (1 valid + 9 tag + 1 hysteresis + 2 page + 6 offset + 7 stride
+                     + 2 confidence + 7 signature + 1 stream + 1 direction)  2368
+    CSPT      128 x (7 stride + 2 confidence)                                  1152
+    RST         8 x (1 valid + 10 region tag + 32 bit vector + 6 offset + 6 + 6
+                     direction counters + 1 dense + 1 trained + 1 tentative
+                     + 3 LRU)                                                 536
+    RR filter  64 x (1 valid + 12 tag)                                         832
+    total                                                                   4888 (611 bytes)
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "../inc/prefetcher.h"
+
+#define IP_TABLE_COUNT 64
+#define IP_TAG_BITS 9
+#define CSPT_COUNT 128
+#define SIGNATURE_MASK (CSPT_COUNT - 1)
+#define RST_COUNT 8
+#define RST_TAG_BITS 10
+// 2 KB regions of 32 lines
+#define REGION_LINES 32
+#define RST_DENSE_LINES 24
+#define RR_FILTER_COUNT 64
+#define RR_TAG_BITS 12
+
+#define GS_DEGREE 6
+#define CS_DEGREE 4
+#define CPLX_DEGREE 3
+
+// strides are 7-bit signed line counts
+#define STRIDE_MAX 63
+#define CONFIDENCE_MAX 3
+#define DIRECTION_COUNTER_MAX 63
+
+enum ip_class { CLASS_NONE, CLASS_GS, CLASS_CS, CLASS_CPLX, CLASS_NL, CLASS_COUNT };
+const char *class_names[CLASS_COUNT] = { "none", "GS", "CS", "CPLX", "NL" };
+
+typedef struct ip_entry
+{
+	int valid;
+	unsigned int tag;
+
+	// set when the IP is seen again, so that one new IP cannot evict a busy one
+	int hysteresis;
+
+	// the low 2 bits of the last page this IP accessed, and the line within it
+	unsigned int last_page;
+	int last_offset;
+
+	// constant stride and its confidence
+	int stride;
+	int confidence;
+
+	// signature of the IP's recent strides, indexing the CSPT
+	unsigned int signature;
+
+	// the IP is part of a global stream, in this direction
+	int stream;
+	int direction;
+} ip_entry_t;
+
+typedef struct cspt_entry
+{
+	int stride;
+	int confidence;
+} cspt_entry_t;
+
+typedef struct rst_entry
+{
+	int valid;
+	unsigned int tag;
+
+	// the lines of the region that have been accessed
+	unsigned int bit_vector;
+	int last_offset;
+
+	// accesses to a line after or before the previous one
+	int positive;
+	int negative;
+
+	// at least RST_DENSE_LINES lines accessed
+	int dense;
+	// this region, or the previous one in the stream's direction, became dense
+	int trained;
+	int tentative;
+
+	int lru;
+} rst_entry_t;
+
+ip_entry_t ip_table[IP_TABLE_COUNT];
+cspt_entry_t cspt[CSPT_COUNT];
+rst_entry_t rst[RST_COUNT];
+// tags of recently requested lines, to avoid prefetching the same line twice
+unsigned int rr_filter[RR_FILTER_COUNT];
+
+unsigned long long int class_accesses[CLASS_COUNT];
+unsigned long long int class_prefetches[CLASS_COUNT];
+
+int saturating_add(int value, int delta, int max)
+{
+	value += delta;
+	if (value > max)
+		return max;
+	if (value < 0)
+		return 0;
+	return value;
+}
+
+// Returns 1 if cl_address was requested recently, and records it otherwise.
+int rr_filter_check(unsigned long long int cl_address)
+{
+	int index = cl_address & (RR_FILTER_COUNT - 1);
+	unsigned int tag = ((cl_address >> 6) & ((1 << RR_TAG_BITS) - 1)) | (1 << RR_TAG_BITS);
+	if (rr_filter[index] == tag)
+		return 1;
+	rr_filter[index] = tag;
+	return 0;
+}
+
+// Issues a prefetch of the line at offset lines from the start of the page of addr, unless it is
+// outside the page or was requested recently.  Returns 0 once the prefetch leaves the page.
+int issue_prefetch(unsigned long long int addr, int offset, int class)
+{
+	if (offset < 0 || offset >= 64)
+		return 0;
+	unsigned long long int pf_address = ((addr >> 12) << 12) | ((unsigned long long int)offset << 6);
+	if (rr_filter_check(pf_address >> 6))
+		return 1;
+
+	// prefetch into the L2 only while it has MSHRs to spare
+	int fill_level = (get_l2_mshr_occupancy(0) < L2_MSHR_COUNT / 2) ? FILL_L2 : FILL_LLC;
+	if (l2_prefetch_line(0, addr, pf_address, fill_level))
+		class_prefetches[class]++;
+	return 1;
+}
+
+// The fallback for an access that has no history to predict from, while MSHRs are not busy.
+void next_line_prefetch(unsigned long long int addr, int offset)
+{
+	class_accesses[CLASS_NL]++;
+	if (get_l2_mshr_occupancy(0) < L2_MSHR_COUNT / 2)
+		issue_prefetch(addr, offset + 1, CLASS_NL);
+}
+
+// Updates the region stream table with an access to cl_address, and returns its entry.
+rst_entry_t *rst_update(unsigned long long int cl_address)
+{
+	unsigned long long int region = cl_address / REGION_LINES;
+	unsigned int tag = region & ((1 << RST_TAG_BITS) - 1);
+	int offset = cl_address % REGION_LINES;
+	int i, index = -1;
+
+	for (i = 0; i < RST_COUNT; i++)
+		if (rst[i].valid && rst[i].tag == tag) {
+			index = i;
+			break;
+		}
+
+	if (index == -1) {
+		// replace a free or else the least recently used region
+		index = 0;
+		for (i = 0; i < RST_COUNT; i++) {
+			if (!rst[i].valid) {
+				index = i;
+				break;
+			}
+			if (rst[i].lru > rst[index].lru)
+				index = i;
+		}
+		rst_entry_t *r = &rst[index];
+		memset(r, 0, sizeof(*r));
+		r->valid = 1;
+		r->lru = RST_COUNT - 1;
+		r->tag = tag;
+		r->last_offset = offset;
+
+		// a stream that swept the neighboring region densely probably continues into this one
+		unsigned int previous = (region - 1) & ((1 << RST_TAG_BITS) - 1);
+		unsigned int next = (region + 1) & ((1 << RST_TAG_BITS) - 1);
+		for (i = 0; i < RST_COUNT; i++) {
+			if (!rst[i].valid || !rst[i].dense || i == index)
+				continue;
+			if (rst[i].tag == previous && rst[i].positive > rst[i].negative) {
+				r->tentative = 1;
+				r->positive = 1;
+			}
+			if (rst[i].tag == next && rst[i].negative > rst[i].positive) {
+				r->tentative = 1;
+				r->negative = 1;
+			}
+		}
+	}
+
+	rst_entry_t *r = &rst[index];
+	for (i = 0; i < RST_COUNT; i++)
+		if (rst[i].valid && rst[i].lru < r->lru)
+			rst[i].lru++;
+	r->lru = 0;
+
+	if (!(r->bit_vector & (1u << offset))) {
+		r->bit_vector |= 1u << offset;
+		if (offset > r->last_offset)
+			r->positive = saturating_add(r->positive, 1, DIRECTION_COUNTER_MAX);
+		else if (offset < r->last_offset)
+			r->negative = saturating_add(r->negative, 1, DIRECTION_COUNTER_MAX);
+		r->last_offset = offset;
+
+		if (__builtin_popcount(r->bit_vector) >= RST_DENSE_LINES) {
+			r->dense = 1;
+			r->trained = 1;
+		}
+	}
+	return r;
+}
+
+void l2_prefetcher_initialize(int cpu_num)
+{
+	printf("IPCP Prefetcher\n");
+	// you can inspect these knob values from your code to see which configuration you're runnig in
+	printf("Knobs visible from prefetcher: %d %d %d\n", knob_scramble_loads, knob_small_llc, knob_low_bandwidth);
+
+	memset(ip_table, 0, sizeof(ip_table));
+	memset(cspt, 0, sizeof(cspt));
+	memset(rst, 0, sizeof(rst));
+	memset(rr_filter, 0, sizeof(rr_filter));
+	memset(class_accesses, 0, sizeof(class_accesses));
+	memset(class_prefetches, 0, sizeof(class_prefetches));
+}
+
+void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned long long int ip, int cache_hit)
+{
+	// uncomment this line to see all the information available to make prefetch decisions
+	// printf("(%lld 0x%llx 0x%llx %d %d %d) ", get_current_cycle(0), addr, ip, cache_hit, get_l2_read_queue_occupancy(0), get_l2_mshr_occupancy(0));
+
+	unsigned long long int cl_address = addr >> 6;
+	unsigned int page = (cl_address >> 6) & 3;
+	int offset = cl_address & 63;
+
+	// demanded lines need no prefetch
+	rr_filter_check(cl_address);
+	rst_entry_t *region = rst_update(cl_address);
+
+	unsigned long long int ip_hash = ip >> 1;
+	ip_entry_t *e = &ip_table[ip_hash & (IP_TABLE_COUNT - 1)];
+	unsigned int tag = (ip_hash >> 6) & ((1 << IP_TAG_BITS) - 1);
+
+	if (!e->valid || e->tag != tag) {
+		if (e->valid && e->hysteresis) {
+			// give the current IP another chance
+			e->hysteresis = 0;
+		}
+		else {
+			memset(e, 0, sizeof(*e));
+			e->valid = 1;
+			e->tag = tag;
+			e->last_page = page;
+			e->last_offset = offset;
+		}
+		// without any history, only a next-line prefetch is possible
+		next_line_prefetch(addr, offset);
+		return;
+	}
+	e->hysteresis = 1;
+
+	// stride in lines, corrected for a move to the next or previous page
+	int stride = offset - e->last_offset;
+	int jumped = 0;
+	if (page == ((e->last_page + 1) & 3))
+		stride += 64;
+	else if (page == ((e->last_page - 1) & 3))
+		stride -= 64;
+	else if (page != e->last_page)
+		jumped = 1;
+	if (stride > STRIDE_MAX || stride < -STRIDE_MAX)
+		jumped = 1;
+
+	if (jumped) {
+		// too far for a stride, so retrain from this access
+		e->last_page = page;
+		e->last_offset = offset;
+		e->stride = 0;
+		e->confidence = 0;
+		next_line_prefetch(addr, offset);
+		return;
+	}
+	if (stride == 0)
+		return;
+
+	// train the constant stride
+	if (stride == e->stride)
+		e->confidence = saturating_add(e->confidence, 1, CONFIDENCE_MAX);
+	else {
+		e->confidence = saturating_add(e->confidence, -1, CONFIDENCE_MAX);
+		if (e->confidence == 0)
+			e->stride = stride;
+	}
+
+	// train the complex stride that followed the IP's previous signature
+	cspt_entry_t *c = &cspt[e->signature];
+	if (stride == c->stride)
+		c->confidence = saturating_add(c->confidence, 1, CONFIDENCE_MAX);
+	else {
+		c->confidence = saturating_add(c->confidence, -1, CONFIDENCE_MAX);
+		if (c->confidence == 0)
+			c->stride = stride;
+	}
+	e->signature = ((e->signature << 1) ^ (stride & SIGNATURE_MASK)) & SIGNATURE_MASK;
+
+	// train the global stream class
+	if (region->trained || region->tentative) {
+		e->stream = 1;
+		e->direction = (region->positive >= region->negative) ? 1 : -1;
+	}
+	else
+		e->stream = 0;
+
+	e->last_page = page;
+	e->last_offset = offset;
+
+	int i, class = CLASS_NL;
+	if (e->stream)
+		class = CLASS_GS;
+	else if (e->confidence > 1)
+		class = CLASS_CS;
+	else if (cspt[e->signature].confidence > 0)
+		class = CLASS_CPLX;
+	class_accesses[class]++;
+
+	switch (class) {
+	case CLASS_GS:
+		for (i = 1; i <= GS_DEGREE; i++)
+			if (!issue_prefetch(addr, offset + i * e->direction, class))
+				break;
+		break;
+	case CLASS_CS:
+		for (i = 1; i <= CS_DEGREE; i++)
+			if (!issue_prefetch(addr, offset + i * e->stride, class))
+				break;
+		break;
+	case CLASS_CPLX: {
+		// follow the chain of predicted strides, while the CSPT is confident of them
+		unsigned int signature = e->signature;
+		int pf_offset = offset;
+		for (i = 0; i < CPLX_DEGREE; i++) {
+			cspt_entry_t *p = &cspt[signature];
+			if (p->confidence == 0)
+				break;
+			pf_offset += p->stride;
+			if (!issue_prefetch(addr, pf_offset, class))
+				break;
+			signature = ((signature << 1) ^ (p->stride & SIGNATURE_MASK)) & SIGNATURE_MASK;
+		}
+		break;
+	}
+	default:
+		if (get_l2_mshr_occupancy(0) < L2_MSHR_COUNT / 2)
+			issue_prefetch(addr, offset + 1, class);
+		break;
+	}
+}
+
+void l2_cache_fill(int cpu_num, unsigned long long int addr, int set, int way, int prefetch, unsigned long long int evicted_addr)
+{
+	// uncomment this line to see the information available to you when there is a cache fill event
+	// printf("0x%llx %d %d %d 0x%llx\n", addr, set, way, prefetch, evicted_addr);
+}
+
+void l2_prefetcher_heartbeat_stats(int cpu_num)
+{
+	printf("Prefetcher heartbeat stats\n");
+}
+
+void l2_prefetcher_warmup_stats(int cpu_num)
+{
+	printf("Prefetcher warmup complete stats\n\n");
+	memset(class_accesses, 0, sizeof(class_accesses));
+	memset(class_prefetches, 0, sizeof(class_prefetches));
+}
+
+void l2_prefetcher_final_stats(int cpu_num)
+{
+	printf("Prefetcher final stats\n");
+	int i;
+	for (i = CLASS_GS; i < CLASS_COUNT; i++)
+		printf("  %s: %llu accesses, %llu prefetches\n", class_names[i], class_accesses[i], class_prefetches[i]);
+}
@@ -0,0 +1,390 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Pythia prefetcher
+
+  A reinforcement learning prefetcher in the manner of Pythia: on every L2
+  access it observes a state, picks one of ACTION_COUNT prefetch offsets
+  (one of which is "no prefetch"), and learns from rewards which offsets
+  pay off in which states, and under how much memory pressure.
+
+  State, two features, each also quantized by L2 MSHR occupancy:
+  - the IP hashed with the line delta from the previous access to the page
+  - the line offset within the page
+  Each feature has a Q-table of PLANE_COUNT hashed planes ("tiles") of
+  fixed-point values; a state-action's value in one feature is the sum of
+  its planes, and its overall value is the larger of the two features'.
+
+  Every action goes into the evaluation queue (EQ) until it is rewarded:
+  - R_TIMELY   a demand access hit the prefetched line after it was filled
+  - R_LATE     a demand access merged into the prefetch while it was in flight
+  - R_INACCURATE  the prefetched line was evicted unused, or left the EQ
+               unused (larger penalty while MSHRs are busy)
+  - R_NO_PREFETCH  "no prefetch" left the EQ (smaller penalty while MSHRs
+               are busy, when staying quiet is the better choice)
+  - R_OUT_OF_PAGE  the offset left the 4 KB page, so nothing was prefetched
+  A prefetch that the L2 does not queue goes into the EQ as "no prefetch",
+  since that is what happened, and a demand hit on a line the prefetch did
+  not fill earns it nothing.
+  When an action leaves the EQ, its Q-values get a SARSA update towards its
+  reward plus GAMMA times the value of the action that followed it.
+  Actions are chosen greedily, except for a random one every 1/EPSILON.
+
+  Storage: 2 features x 3 planes x 128 rows x 16 actions x 16 bits = 24 KB
+  of Q-values, plus 256 EQ entries and 64 page trackers.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "../inc/prefetcher.h"
+
+#define FEATURE_COUNT 2
+#define PLANE_COUNT 3
+#define ROW_BITS 7
+#define ROW_COUNT (1 << ROW_BITS)
+#define ACTION_COUNT 16
+#define NO_PREFETCH_ACTION 3
+
+#define EQ_SIZE 256
+#define PAGE_TRACKER_COUNT 64
+
+// Q-values are fixed point, with Q_FRACTION_BITS fractional bits
+#define Q_FRACTION_BITS 8
+#define Q_ONE (1 << Q_FRACTION_BITS)
+// learning rate ALPHA_NUMERATOR / 1024, about 0.0068
+#define ALPHA_NUMERATOR 7
+// discount factor GAMMA_NUMERATOR / 256, about 0.556
+#define GAMMA_NUMERATOR 142
+// explore with one random action in EPSILON_INVERSE
+#define EPSILON_INVERSE 512
+
+#define R_TIMELY 20
+#define R_LATE 12
+#define R_OUT_OF_PAGE -12
+#define R_INACCURATE_LOW_BW -8
+#define R_INACCURATE_HIGH_BW -14
+#define R_NO_PREFETCH_LOW_BW -4
+#define R_NO_PREFETCH_HIGH_BW -2
+
+// MSHR occupancy at or above which memory pressure counts as high
+#define HIGH_BW_MSHR (L2_MSHR_COUNT * 3 / 4)
+
+int actions[ACTION_COUNT] = { -6, -3, -1, 0, 1, 3, 4, 5, 10, 11, 12, 16, 22, 23, 30, 32 };
+
+short q_table[FEATURE_COUNT][PLANE_COUNT][ROW_COUNT][ACTION_COUNT];
+
+typedef struct state
+{
+	unsigned int feature[FEATURE_COUNT];
+} state_t;
+
+typedef struct eq_entry
+{
+	int valid;
+	state_t state;
+	int action;
+
+	// cache line address of the prefetch, 0 for no prefetch or one the L2 did not queue
+	unsigned long long int pf_line;
+	// the prefetch has been filled into the L2
+	int filled;
+
+	int rewarded;
+	int reward;
+} eq_entry_t;
+
+// circular FIFO; eq_head is the oldest entry
+eq_entry_t eq[EQ_SIZE];
+int eq_head, eq_count;
+
+typedef struct page_tracker
+{
+	unsigned long long int page;
+	int last_offset;
+	unsigned long long int lru;
+} page_tracker_t;
+
+page_tracker_t page_trackers[PAGE_TRACKER_COUNT];
+unsigned long long int access_count;
+
+unsigned int random_state;
+
+unsigned long long int action_counts[ACTION_COUNT];
+unsigned long long int reward_timely, reward_late, reward_inaccurate, reward_no_prefetch, reward_out_of_page;
+unsigned long long int prefetches_not_queued;
+
+unsigned int next_random()
+{
+	// xorshift32, seeded in l2_prefetcher_initialize() so runs repeat exactly
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+int high_bandwidth()
+{
+	return get_l2_mshr_occupancy(0) >= HIGH_BW_MSHR;
+}
+
+int row(unsigned int value, int plane)
+{
+	// each plane hashes the feature differently, so that two values rarely collide in every plane
+	static const unsigned int salts[PLANE_COUNT] = { 0x0, 0x5bd1e995, 0x27d4eb2f };
+	unsigned int h = (value ^ salts[plane]) * 0x9e3779b1u;
+	return h >> (32 - ROW_BITS);
+}
+
+int feature_q(const state_t *s, int feature, int action)
+{
+	int p, q = 0;
+	for (p = 0; p < PLANE_COUNT; p++)
+		q += q_table[feature][p][row(s->feature[feature], p)][action];
+	return q;
+}
+
+int q_value(const state_t *s, int action)
+{
+	int f, best = feature_q(s, 0, action);
+	for (f = 1; f < FEATURE_COUNT; f++) {
+		int q = feature_q(s, f, action);
+		if (q > best)
+			best = q;
+	}
+	return best;
+}
+
+int choose_action(const state_t *s)
+{
+	if (next_random() % EPSILON_INVERSE == 0)
+		return next_random() % ACTION_COUNT;
+
+	int a, best = 0, best_q = q_value(s, 0);
+	for (a = 1; a < ACTION_COUNT; a++) {
+		int q = q_value(s, a);
+		if (q > best_q) {
+			best = a;
+			best_q = q;
+		}
+	}
+	return best;
+}
+
+// SARSA: moves Q(s1, a1) towards reward + GAMMA * Q(s2, a2), spread over the planes of each feature.
+void sarsa_update(const state_t *s1, int a1, int reward, const state_t *s2, int a2)
+{
+	int target = reward * Q_ONE + GAMMA_NUMERATOR * q_value(s2, a2) / 256;
+	int f, p;
+	for (f = 0; f < FEATURE_COUNT; f++) {
+		int error = target - feature_q(s1, f, a1);
+		int step = error * ALPHA_NUMERATOR / (1024 * PLANE_COUNT);
+		for (p = 0; p < PLANE_COUNT; p++) {
+			short *q = &q_table[f][p][row(s1->feature[f], p)][a1];
+			int updated = *q + step;
+			if (updated > 32767)
+				updated = 32767;
+			if (updated < -32768)
+				updated = -32768;
+			*q = updated;
+		}
+	}
+}
+
+void assign_reward(eq_entry_t *e, int reward)
+{
+	e->rewarded = 1;
+	e->reward = reward;
+	if (reward == R_TIMELY)
+		reward_timely++;
+	else if (reward == R_LATE)
+		reward_late++;
+	else if (reward == R_OUT_OF_PAGE)
+		reward_out_of_page++;
+	else if (e->pf_line == 0)
+		reward_no_prefetch++;
+	else
+		reward_inaccurate++;
+}
+
+// Adds an action to the EQ; when the EQ is full, the oldest action leaves it and is learned from.
+void eq_insert(const state_t *s, int action, unsigned long long int pf_line)
+{
+	if (eq_count == EQ_SIZE) {
+		eq_entry_t *old = &eq[eq_head];
+		eq_head = (eq_head + 1) % EQ_SIZE;
+		eq_count--;
+
+		if (!old->rewarded) {
+			if (old->pf_line == 0)
+				assign_reward(old, high_bandwidth() ? R_NO_PREFETCH_HIGH_BW : R_NO_PREFETCH_LOW_BW);
+			else
+				assign_reward(old, high_bandwidth() ? R_INACCURATE_HIGH_BW : R_INACCURATE_LOW_BW);
+		}
+		// the action taken after the old one is now the oldest in the EQ, or the new one
+		eq_entry_t *next = &eq[eq_head];
+		if (eq_count > 0)
+			sarsa_update(&old->state, old->action, old->reward, &next->state, next->action);
+		else
+			sarsa_update(&old->state, old->action, old->reward, s, action);
+	}
+
+	eq_entry_t *e = &eq[(eq_head + eq_count) % EQ_SIZE];
+	eq_count++;
+	memset(e, 0, sizeof(*e));
+	e->valid = 1;
+	e->state = *s;
+	e->action = action;
+	e->pf_line = pf_line;
+}
+
+void l2_prefetcher_initialize(int cpu_num)
+{
+	printf("Pythia Prefetcher\n");
+	// you can inspect these knob values from your code to see which configuration you're runnig in
+	printf("Knobs visible from prefetcher: %d %d %d\n", knob_scramble_loads, knob_small_llc, knob_low_bandwidth);
+
+	// start optimistic, at the value of a reward of 1 forever, so that every action gets tried
+	int f, p, r, a;
+	int initial = (Q_ONE * 256 / (256 - GAMMA_NUMERATOR)) / PLANE_COUNT;
+	for (f = 0; f < FEATURE_COUNT; f++)
+		for (p = 0; p < PLANE_COUNT; p++)
+			for (r = 0; r < ROW_COUNT; r++)
+				for (a = 0; a < ACTION_COUNT; a++)
+					q_table[f][p][r][a] = initial;
+
+	memset(eq, 0, sizeof(eq));
+	eq_head = 0;
+	eq_count = 0;
+	memset(page_trackers, 0, sizeof(page_trackers));
+	access_count = 0;
+	random_state = 0x2545f491;
+
+	memset(action_counts, 0, sizeof(action_counts));
+	reward_timely = reward_late = reward_inaccurate = reward_no_prefetch = reward_out_of_page = 0;
+	prefetches_not_queued = 0;
+}
+
+void l2_prefetcher_operate(int cpu_num, unsigned long long int addr, unsigned long long int ip, int cache_hit)
+{
+	// uncomment this line to see all the information available to make prefetch decisions
+	// printf("(%lld 0x%llx 0x%llx %d %d %d) ", get_current_cycle(0), addr, ip, cache_hit, get_l2_read_queue_occupancy(0), get_l2_mshr_occupancy(0));
+
+	unsigned long long int cl_address = addr >> 6;
+	unsigned long long int page = cl_address >> 6;
+	int offset = cl_address & 63;
+	int i;
+
+	// reward the actions that prefetched this line
+	for (i = 0; i < eq_count; i++) {
+		eq_entry_t *e = &eq[(eq_head + i) % EQ_SIZE];
+		if (e->rewarded || e->pf_line != cl_address)
+			continue;
+		// a hit on a line this prefetch never filled was not its doing, and earns nothing
+		if (cache_hit && e->filled)
+			assign_reward(e, R_TIMELY);
+		else if (!cache_hit)
+			assign_reward(e, R_LATE);
+	}
+
+	// the line delta since the previous access to this page
+	access_count++;
+	int tracker = -1, lru = 0;
+	for (i = 0; i < PAGE_TRACKER_COUNT; i++) {
+		if (page_trackers[i].page == page) {
+			tracker = i;
+			break;
+		}
+		if (page_trackers[i].lru < page_trackers[lru].lru)
+			lru = i;
+	}
+	int delta = 0;
+	if (tracker == -1) {
+		tracker = lru;
+		page_trackers[tracker].page = page;
+	}
+	else
+		delta = offset - page_trackers[tracker].last_offset;
+	page_trackers[tracker].last_offset = offset;
+	page_trackers[tracker].lru = access_count;
+
+	// quantize MSHR occupancy into 4 levels
+	unsigned int bandwidth = get_l2_mshr_occupancy(0) * 4 / (L2_MSHR_COUNT + 1);
+	state_t s;
+	s.feature[0] = ((unsigned int)(ip ^ (ip >> 16)) << 9) ^ ((delta & 127) << 2) ^ bandwidth;
+	s.feature[1] = (offset << 2) | bandwidth;
+
+	int action = choose_action(&s);
+	action_counts[action]++;
+
+	if (action == NO_PREFETCH_ACTION) {
+		eq_insert(&s, action, 0);
+		return;
+	}
+
+	int pf_offset = offset + actions[action];
+	if (pf_offset < 0 || pf_offset >= 64) {
+		// nothing can be prefetched outside the page, so the action is judged right away
+		eq_insert(&s, action, 0);
+		assign_reward(&eq[(eq_head + eq_count - 1) % EQ_SIZE], R_OUT_OF_PAGE);
+		return;
+	}
+
+	unsigned long long int pf_line = (page << 6) | pf_offset;
+	int fill_level = (get_l2_mshr_occupancy(0) < L2_MSHR_COUNT / 2) ? FILL_L2 : FILL_LLC;
+	if (!l2_prefetch_line(0, addr, pf_line << 6, fill_level)) {
+		// nothing was prefetched, so learn from what actually happened
+		prefetches_not_queued++;
+		eq_insert(&s, NO_PREFETCH_ACTION, 0);
+		return;
+	}
+	eq_insert(&s, action, pf_line);
+}
+
+void l2_cache_fill(int cpu_num, unsigned long long int addr, int set, int way, int prefetch, unsigned long long int evicted_addr)
+{
+	// uncomment this line to see the information available to you when there is a cache fill event
+	// printf("0x%llx %d %d %d 0x%llx\n", addr, set, way, prefetch, evicted_addr);
+
+	unsigned long long int cl_address = addr >> 6;
+	unsigned long long int evicted_line = evicted_addr >> 6;
+	int i;
+	for (i = 0; i < eq_count; i++) {
+		eq_entry_t *e = &eq[(eq_head + i) % EQ_SIZE];
+		if (e->rewarded || e->pf_line == 0)
+			continue;
+		if (prefetch && e->pf_line == cl_address)
+			e->filled = 1;
+		else if (e->filled && e->pf_line == evicted_line)
+			assign_reward(e, high_bandwidth() ? R_INACCURATE_HIGH_BW : R_INACCURATE_LOW_BW);
+	}
+}
+
+void l2_prefetcher_heartbeat_stats(int cpu_num)
+{
+	printf("Prefetcher heartbeat stats\n");
+}
+
+void l2_prefetcher_warmup_stats(int cpu_num)
+{
+	printf("Prefetcher warmup complete stats\n\n");
+	memset(action_counts, 0, sizeof(action_counts));
+	reward_timely = reward_late = reward_inaccurate = reward_no_prefetch = reward_out_of_page = 0;
+	prefetches_not_queued = 0;
+}
+
+void l2_prefetcher_final_stats(int cpu_num)
+{
+	printf("Prefetcher final stats\n");
+	printf("Rewards: timely %llu late %llu inaccurate %llu no_prefetch %llu out_of_page %llu\n",
+	       reward_timely, reward_late, reward_inaccurate, reward_no_prefetch, reward_out_of_page);
+	printf("Prefetches not queued: %llu\n", prefetches_not_queued);
+	printf("Actions:");
+	int a;
+	for (a = 0; a < ACTION_COUNT; a++)
+		printf(" %+d:%llu", actions[a], action_counts[a]);
+	printf("\n");
+}
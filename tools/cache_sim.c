@@ -0,0 +1,1674 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Functional cache simulator
+
+  Replays a .dpc trace through a DCU / MLC (L2) / LLC hierarchy without any
+  timing, and drives an unmodified L2 prefetcher through the same interface
+  that lib/dpc2sim.a offers (inc/prefetcher.h).  It is much faster than the
+  timing simulator and is meant for studies that only need hit/miss behavior.
+
+  Differences from the timing simulator:
+  - get_current_cycle() returns the number of retired instructions.
+  - MSHRs are never occupied, and prefetches wait in the L2 read queue only
+    until the demand access that issued them has completed.
+  - Stall cycles are estimates built from fixed per-level latencies, with no
+    overlap between misses.
+
+  An optional L1 DTLB / L2 STLB model (-tlb) translates every demand access.
+  STLB misses start a 4-level page walk whose page table entry loads go
+  through the cache hierarchy like any other load.
+
+  The LLC can be inclusive, exclusive or non-inclusive non-exclusive (NINE)
+  of the DCU and MLC (-llc_inclusion).
+  - inclusive: every fill also fills the LLC, and an LLC eviction
+    invalidates the line in the MLC and DCU (back-invalidation).
+  - exclusive: lines fetched for the MLC are not kept in the LLC, an LLC hit
+    moves the line up into the MLC, and MLC victims are filled into the LLC.
+  - nine: fills go to both levels, and either level evicts on its own.
+
+  Upper bounds for prefetching studies:
+  - -perfect_l2 turns every MLC demand miss into a hit.
+  - -perfect_llc turns every LLC demand miss into a hit.
+  - -oracle_prefetch N reads the trace N instructions ahead and prefetches
+    every future line that is in neither the DCU nor the MLC into the MLC.
+    Counting one cycle per instruction, a prefetch issued when its line is
+    found arrives N cycles before the demand at best.  Its fill takes the
+    LLC or DRAM latency, and a demand that comes earlier waits for the rest
+    of it.  Requests wait in an oracle queue of their own, as deep as the L2
+    read queue, and issue while one of L2_MSHR_COUNT oracle MSHRs is free
+    and, for lines read from DRAM, the configured memory bandwidth allows.
+    The oracle has counters of its own, so the linked prefetcher's
+    statistics only count its own requests.
+  The final stats include an estimated IPC, which tools/headroom.sh uses to
+  compare a prefetcher against these bounds.
+
+  With -classify_misses, every demand access to the MLC and LLC is also
+  looked up in two shadow models of that level: an infinite cache, and a
+  fully-associative LRU cache of the same capacity.  A miss that the
+  infinite cache also misses is compulsory, one that the fully-associative
+  cache also misses is a capacity miss, and the rest are conflict misses.
+  Demand hits on prefetched lines are classified the same way, which gives
+  the prefetch coverage of each class.
+
+  With -adaptive_warmup, -warmup_instructions is only an upper bound.  Every
+  heartbeat during warmup samples the DCU, MLC and LLC miss rates of the last
+  heartbeat and the fraction of their lines that are valid, and warmup ends
+  once none of these has moved by more than -warmup_tolerance over the last
+  WARMUP_WINDOW heartbeats.  Each cache must also be nearly full, or fill
+  over that window at no more than -warmup_tolerance times its average rate
+  since warmup began.
+
+  With -interval N, the statistics of every N instructions after warmup are
+  kept in a columnar time series and written to -interval_file when the
+  simulation ends, as CSV if the file name ends in .csv, and in a compact
+  binary form otherwise:
+    char magic[8] = "DPC2INTV"
+    unsigned long long int columns, rows
+    columns NUL-terminated column names
+    columns arrays of rows unsigned long long int counters, one column after another
+
+  When stdin is a regular file, such as a decompressed trace from
+  tools/trace_cache.sh, it is mapped read-only rather than read, so that
+  simulators running on the same trace share its pages.
+
+  Memory-only traces from tools/trace_project.c are recognized by their
+  magic number, and read as if every instruction without a memory operation
+  were an empty record.
+
+  Compiled with -DCACHE_SIM_LIBRARY, there is no main(), and the simulator
+  is driven through the functions declared in inc/cache_sim.h instead, for
+  example from Python with tools/cache_sim.py:
+    gcc -O2 -shared -fPIC -DCACHE_SIM_LIBRARY -o cache_sim_fdp.so tools/cache_sim.c src/fdp.c
+  All state is global, so a process can only hold one simulator per loaded
+  copy of the library.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include "../inc/prefetcher.h"
+#include "../inc/cache_sim.h"
+#include "../inc/trace.h"
+
+#define DCU_SET_COUNT 64
+#define DCU_ASSOCIATIVITY 8
+#define LLC_SET_COUNT 1024
+#define SMALL_LLC_SET_COUNT 256
+#define LLC_ASSOCIATIVITY 16
+
+#define DTLB_SET_COUNT 16
+#define DTLB_ASSOCIATIVITY 4
+#define STLB_SET_COUNT 128
+#define STLB_ASSOCIATIVITY 4
+
+// page table entries live far above any user-space virtual address in the traces
+#define PAGE_WALK_LEVELS 4
+#define PAGE_TABLE_BASE (1ULL << 52)
+
+// latencies used only to estimate stall cycles
+#define DCU_LATENCY 4
+#define MLC_LATENCY 12
+#define LLC_LATENCY 26
+#define DRAM_LATENCY 200
+#define STLB_LATENCY 7
+
+#define HEARTBEAT_INSTRUCTIONS 100000
+
+// heartbeats over which adaptive warmup checks that the caches have settled
+#define WARMUP_WINDOW 5
+#define WARMUP_METRICS 6
+
+#define INTERVAL_COLUMNS 8
+
+// lines per 1000 cycles that 12.8 GB/s and 3.2 GB/s deliver to a 4 GHz core
+#define DRAM_LINES_PER_KILO_CYCLE 50
+#define LOW_BANDWIDTH_DRAM_LINES_PER_KILO_CYCLE 12.5
+
+// where an access was satisfied
+#define LEVEL_DCU 0
+#define LEVEL_MLC 1
+#define LEVEL_LLC 2
+#define LEVEL_DRAM 3
+
+#define ACCESS_LOAD 0
+#define ACCESS_STORE 1
+#define ACCESS_WALK 2
+
+#define INCLUSION_NINE 0
+#define INCLUSION_INCLUSIVE 1
+#define INCLUSION_EXCLUSIVE 2
+
+#define MISS_COMPULSORY 0
+#define MISS_CAPACITY 1
+#define MISS_CONFLICT 2
+#define MISS_CLASS_COUNT 3
+
+int knob_low_bandwidth;
+int knob_small_llc;
+int knob_scramble_loads;
+int knob_hide_heartbeat;
+int knob_tlb;
+int knob_walk_latency = 20;
+int knob_llc_inclusion = INCLUSION_NINE;
+int knob_perfect_l2;
+int knob_perfect_llc;
+int knob_oracle_distance;
+int knob_classify_misses;
+int knob_adaptive_warmup;
+double knob_warmup_tolerance = 0.01;
+long long int knob_interval;
+const char *knob_interval_file = "intervals.csv";
+
+static long long int warmup_instructions = 10000000;
+static long long int simulation_instructions = 100000000;
+
+static int level_latency[4] = { DCU_LATENCY, MLC_LATENCY, LLC_LATENCY, DRAM_LATENCY };
+
+typedef struct cache_line
+{
+	// line address (byte address >> 6), or page number for the TLBs
+	unsigned long long int addr;
+
+	int valid;
+	int dirty;
+
+	// set when the line was brought in by a prefetch and has not been demand accessed since
+	int prefetch;
+	// the same for a line the oracle brought in
+	int oracle;
+	// cycle at which the oracle's fill of this line arrives
+	unsigned long long int ready;
+
+	unsigned long long int lru;
+} cache_line_t;
+
+// open-addressed hash set of every line a level has ever seen; keys are stored as line + 1
+typedef struct line_set
+{
+	unsigned long long int *keys;
+	unsigned long long int mask;
+	unsigned long long int count;
+} line_set_t;
+
+typedef struct lru_node
+{
+	unsigned long long int addr;
+
+	// neighbours in recency order, and the next node in the same hash bucket
+	int prev;
+	int next;
+	int bucket_next;
+} lru_node_t;
+
+// fully-associative LRU cache: a hash map from line to node, plus a recency list, for O(1) per access
+typedef struct lru_cache
+{
+	lru_node_t *nodes;
+	int capacity;
+	int count;
+	int head;
+	int tail;
+	int *buckets;
+	int bucket_mask;
+} lru_cache_t;
+
+typedef struct shadow
+{
+	line_set_t seen;
+	lru_cache_t fully_associative;
+
+	unsigned long long int misses[MISS_CLASS_COUNT];
+	unsigned long long int covered[MISS_CLASS_COUNT];
+} shadow_t;
+
+typedef struct cache
+{
+	const char *name;
+	int sets;
+	int ways;
+	cache_line_t *lines;
+
+	// miss classification models, or NULL without -classify_misses
+	shadow_t *shadow;
+
+	// demand statistics, reset when warmup completes
+	unsigned long long int access;
+	unsigned long long int hit;
+	unsigned long long int miss;
+	unsigned long long int pf_fill;
+	unsigned long long int pf_useful;
+	unsigned long long int writeback;
+} cache_t;
+
+static cache_t dcu, mlc, llc, dtlb, stlb;
+
+static unsigned long long int lru_clock;
+static unsigned long long int instructions;
+static unsigned long long int stats_instructions;
+static unsigned long long int dram_reads, dram_writes;
+static unsigned long long int pf_requested, pf_issued;
+static unsigned long long int oracle_requested, oracle_dropped, oracle_issued, oracle_dram_reads, oracle_useful, oracle_late;
+
+// DRAM lines the oracle may still fetch, refilled every instruction
+static double oracle_tokens;
+
+// lines the oracle has found but not issued yet, oldest first
+static unsigned long long int oracle_queue[L2_READ_QUEUE_SIZE];
+static int oracle_queue_head, oracle_queue_count;
+// arrival cycles of the oracle's fills; an MSHR whose fill has arrived is free
+static unsigned long long int oracle_mshr[L2_MSHR_COUNT];
+
+// adaptive warmup samples, one row per heartbeat, kept in a ring of WARMUP_WINDOW rows
+static double warmup_samples[WARMUP_WINDOW][WARMUP_METRICS];
+static int warmup_sample_count;
+static unsigned long long int warmup_last_access[3], warmup_last_miss[3];
+
+static const char *interval_column_names[INTERVAL_COLUMNS] = {
+	"instructions", "cycles", "l2_misses", "llc_misses", "prefetches_issued", "prefetches_useful", "dram_reads", "dram_writes"
+};
+
+// -interval time series, one array per column so that every column is contiguous
+static unsigned long long int *interval_columns[INTERVAL_COLUMNS];
+static int interval_rows, interval_capacity;
+// counter values at the end of the previous interval
+static unsigned long long int interval_last[INTERVAL_COLUMNS];
+static unsigned long long int data_stall_cycles;
+static unsigned long long int page_walks, walk_cycles, stlb_cycles;
+static unsigned long long int back_invalidations, victim_fills;
+
+// unique lines held by the MLC and LLC together, sampled every heartbeat
+static unsigned long long int capacity_samples, capacity_lines;
+
+// the trace, stdin unless embedded; mapped into memory if it is a regular file, or NULL if read with fread
+static FILE *trace_file;
+static const trace_instr_format_t *trace_map;
+static size_t trace_map_records, trace_map_next, trace_map_length;
+// bytes read to check for a memory-only trace, which belong to the first record otherwise
+static char trace_prefix[8];
+static size_t trace_prefix_length;
+
+// the current block of a memory-only trace (tools/trace_project.c)
+static int memory_trace, memory_trace_ended;
+static unsigned long long int memory_ip[MEMORY_TRACE_BLOCK];
+static unsigned long long int memory_addr[MEMORY_TRACE_BLOCK];
+static unsigned int memory_gap[MEMORY_TRACE_BLOCK];
+static unsigned char memory_store[MEMORY_TRACE_BLOCK];
+static unsigned int memory_count, memory_next;
+// instructions without memory operations to replay before the next operation
+static unsigned long long int memory_skip;
+
+// records are read knob_oracle_distance instructions ahead of the one being simulated
+static trace_instr_format_t *window;
+static int window_size, window_head, window_count;
+static int warmup_complete, warmup_settled;
+
+typedef struct prefetch_request
+{
+	unsigned long long int addr;
+	int fill_level;
+} prefetch_request_t;
+
+// prefetches sit here until the demand access that issued them has completed
+static prefetch_request_t read_queue[L2_READ_QUEUE_SIZE];
+static int read_queue_occupancy;
+
+static void cache_initialize(cache_t *c, const char *name, int sets, int ways)
+{
+	c->name = name;
+	c->sets = sets;
+	c->ways = ways;
+	c->lines = calloc(sets * ways, sizeof(cache_line_t));
+	assert(c->lines != NULL);
+}
+
+static void cache_reset_stats(cache_t *c)
+{
+	c->access = 0;
+	c->hit = 0;
+	c->miss = 0;
+	c->pf_fill = 0;
+	c->pf_useful = 0;
+	c->writeback = 0;
+
+	if (c->shadow != NULL) {
+		memset(c->shadow->misses, 0, sizeof(c->shadow->misses));
+		memset(c->shadow->covered, 0, sizeof(c->shadow->covered));
+	}
+}
+
+static int cache_get_set(cache_t *c, unsigned long long int addr)
+{
+	return addr & (c->sets - 1);
+}
+
+static cache_line_t *cache_line(cache_t *c, int set, int way)
+{
+	return &c->lines[set * c->ways + way];
+}
+
+// Returns the way holding addr, or -1 on a miss.
+static int cache_find(cache_t *c, unsigned long long int addr)
+{
+	int set = cache_get_set(c, addr);
+	int way;
+	for (way = 0; way < c->ways; way++) {
+		cache_line_t *l = cache_line(c, set, way);
+		if (l->valid && l->addr == addr)
+			return way;
+	}
+	return -1;
+}
+
+static void cache_touch(cache_t *c, int set, int way)
+{
+	cache_line(c, set, way)->lru = ++lru_clock;
+}
+
+// Installs addr, which must not already be present, and returns its way.
+// The replaced line, if any, is copied to *victim; victim->valid is 0 otherwise.
+static int cache_fill(cache_t *c, unsigned long long int addr, int prefetch, cache_line_t *victim)
+{
+	int set = cache_get_set(c, addr);
+	int way, lru_way = 0;
+	for (way = 0; way < c->ways; way++) {
+		cache_line_t *l = cache_line(c, set, way);
+		if (!l->valid) {
+			lru_way = way;
+			break;
+		}
+		if (l->lru < cache_line(c, set, lru_way)->lru)
+			lru_way = way;
+	}
+
+	cache_line_t *l = cache_line(c, set, lru_way);
+	*victim = *l;
+
+	l->addr = addr;
+	l->valid = 1;
+	l->dirty = 0;
+	l->prefetch = prefetch;
+	l->oracle = 0;
+	l->ready = 0;
+	l->lru = ++lru_clock;
+
+	return lru_way;
+}
+
+// Drops line from c if present, and returns 1 if the dropped copy was dirty.
+static int cache_invalidate(cache_t *c, unsigned long long int line)
+{
+	int way = cache_find(c, line);
+	if (way < 0)
+		return 0;
+
+	cache_line_t *l = cache_line(c, cache_get_set(c, line), way);
+	l->valid = 0;
+	return l->dirty;
+}
+
+static unsigned long long int line_hash(unsigned long long int line)
+{
+	return line * 0x9e3779b97f4a7c15ULL;
+}
+
+// Adds line to the set, and returns 1 if it was already there.
+static int line_set_insert(line_set_t *set, unsigned long long int line)
+{
+	unsigned long long int i;
+
+	if (2 * (set->count + 1) > set->mask + 1) {
+		// keep the load factor under one half
+		line_set_t grown;
+		grown.mask = 2 * set->mask + 1;
+		grown.count = 0;
+		grown.keys = calloc(grown.mask + 1, sizeof(unsigned long long int));
+		assert(grown.keys != NULL);
+		for (i = 0; i <= set->mask; i++)
+			if (set->keys[i])
+				line_set_insert(&grown, set->keys[i] - 1);
+		free(set->keys);
+		*set = grown;
+	}
+
+	for (i = line_hash(line) & set->mask; set->keys[i]; i = (i + 1) & set->mask)
+		if (set->keys[i] == line + 1)
+			return 1;
+	set->keys[i] = line + 1;
+	set->count++;
+	return 0;
+}
+
+static void lru_unlink(lru_cache_t *c, int n)
+{
+	if (c->nodes[n].prev >= 0)
+		c->nodes[c->nodes[n].prev].next = c->nodes[n].next;
+	else
+		c->head = c->nodes[n].next;
+	if (c->nodes[n].next >= 0)
+		c->nodes[c->nodes[n].next].prev = c->nodes[n].prev;
+	else
+		c->tail = c->nodes[n].prev;
+}
+
+static void lru_push_front(lru_cache_t *c, int n)
+{
+	c->nodes[n].prev = -1;
+	c->nodes[n].next = c->head;
+	if (c->head >= 0)
+		c->nodes[c->head].prev = n;
+	c->head = n;
+	if (c->tail < 0)
+		c->tail = n;
+}
+
+// Looks up line, makes it the most recently used entry, and returns 1 if it was already present.
+static int lru_access(lru_cache_t *c, unsigned long long int line)
+{
+	int *bucket = &c->buckets[line_hash(line) & c->bucket_mask];
+	int n;
+	for (n = *bucket; n >= 0; n = c->nodes[n].bucket_next) {
+		if (c->nodes[n].addr == line) {
+			lru_unlink(c, n);
+			lru_push_front(c, n);
+			return 1;
+		}
+	}
+
+	if (c->count < c->capacity)
+		n = c->count++;
+	else {
+		// recycle the least recently used node
+		n = c->tail;
+		lru_unlink(c, n);
+		int *link = &c->buckets[line_hash(c->nodes[n].addr) & c->bucket_mask];
+		while (*link != n)
+			link = &c->nodes[*link].bucket_next;
+		*link = c->nodes[n].bucket_next;
+	}
+
+	c->nodes[n].addr = line;
+	c->nodes[n].bucket_next = *bucket;
+	*bucket = n;
+	lru_push_front(c, n);
+	return 0;
+}
+
+static void shadow_initialize(cache_t *c)
+{
+	shadow_t *s = calloc(1, sizeof(shadow_t));
+	assert(s != NULL);
+
+	s->seen.mask = 1023;
+	s->seen.keys = calloc(s->seen.mask + 1, sizeof(unsigned long long int));
+
+	lru_cache_t *fa = &s->fully_associative;
+	fa->capacity = c->sets * c->ways;
+	fa->nodes = calloc(fa->capacity, sizeof(lru_node_t));
+	fa->head = -1;
+	fa->tail = -1;
+	for (fa->bucket_mask = 1; fa->bucket_mask < 2 * fa->capacity; fa->bucket_mask <<= 1)
+		;
+	fa->buckets = malloc(fa->bucket_mask * sizeof(int));
+	memset(fa->buckets, -1, fa->bucket_mask * sizeof(int));
+	fa->bucket_mask--;
+	assert((s->seen.keys != NULL) && (fa->nodes != NULL) && (fa->buckets != NULL));
+
+	c->shadow = s;
+}
+
+// Returns the class a demand miss on line would fall in, or -1 without -classify_misses.
+static int shadow_access(cache_t *c, unsigned long long int line)
+{
+	if (c->shadow == NULL)
+		return -1;
+
+	int seen = line_set_insert(&c->shadow->seen, line);
+	int fa_hit = lru_access(&c->shadow->fully_associative, line);
+	if (!seen)
+		return MISS_COMPULSORY;
+	return fa_hit ? MISS_CONFLICT : MISS_CAPACITY;
+}
+
+static void llc_evict(cache_line_t *victim)
+{
+	if (!victim->valid)
+		return;
+
+	int dirty = victim->dirty;
+	if (knob_llc_inclusion == INCLUSION_INCLUSIVE) {
+		// the upper levels may not keep a line the LLC no longer holds
+		if ((cache_find(&mlc, victim->addr) >= 0) || (cache_find(&dcu, victim->addr) >= 0))
+			back_invalidations++;
+		if (cache_invalidate(&mlc, victim->addr))
+			dirty = 1;
+		if (cache_invalidate(&dcu, victim->addr))
+			dirty = 1;
+	}
+
+	if (dirty) {
+		llc.writeback++;
+		dram_writes++;
+	}
+}
+
+// Places an MLC victim into the LLC, as an exclusive LLC does for every line leaving the MLC.
+static void llc_victim_fill(unsigned long long int line, int dirty)
+{
+	int way = cache_find(&llc, line);
+	if (way >= 0) {
+		if (dirty)
+			cache_line(&llc, cache_get_set(&llc, line), way)->dirty = 1;
+		return;
+	}
+
+	cache_line_t victim;
+	way = cache_fill(&llc, line, 0, &victim);
+	cache_line(&llc, cache_get_set(&llc, line), way)->dirty = dirty;
+	llc_evict(&victim);
+	victim_fills++;
+}
+
+static void llc_writeback(unsigned long long int line)
+{
+	int way = cache_find(&llc, line);
+	if (way >= 0) {
+		cache_line(&llc, cache_get_set(&llc, line), way)->dirty = 1;
+		return;
+	}
+	llc.writeback++;
+	dram_writes++;
+}
+
+static void mlc_writeback(unsigned long long int line)
+{
+	int way = cache_find(&mlc, line);
+	if (way >= 0) {
+		cache_line(&mlc, cache_get_set(&mlc, line), way)->dirty = 1;
+		return;
+	}
+	mlc.writeback++;
+	llc_writeback(line);
+}
+
+// Places line, which a perfect cache made up rather than fetched, into the LLC on its way to
+// fill_level wherever the inclusion policy keeps it.  Returns 1 when an exclusive LLC hands a
+// dirty copy up to the MLC.
+static int llc_install(unsigned long long int line, int fill_level)
+{
+	int way = cache_find(&llc, line);
+
+	if ((knob_llc_inclusion == INCLUSION_EXCLUSIVE) && (fill_level == FILL_L2)) {
+		// the line moves up, and comes back as an MLC victim later
+		return (way >= 0) ? cache_invalidate(&llc, line) : 0;
+	}
+
+	if (way >= 0) {
+		cache_touch(&llc, cache_get_set(&llc, line), way);
+		return 0;
+	}
+
+	cache_line_t victim;
+	cache_fill(&llc, line, 0, &victim);
+	llc_evict(&victim);
+	return 0;
+}
+
+// Looks up line in the LLC on its way to fill_level, and returns where it was found.
+// FILL_L2 requests are on their way to the MLC; FILL_LLC requests are LLC prefetches.
+// *dirty is set when an exclusive LLC hands a dirty line up to the MLC.
+static int llc_access(unsigned long long int line, int demand, int fill_level, int *dirty)
+{
+	int set = cache_get_set(&llc, line);
+	int way = cache_find(&llc, line);
+
+	int miss_class = demand ? shadow_access(&llc, line) : -1;
+
+	*dirty = 0;
+	if (demand)
+		llc.access++;
+
+	if ((way < 0) && demand && knob_perfect_llc) {
+		// the line comes from nowhere, but still takes its place in the LLC
+		llc.hit++;
+		llc_install(line, fill_level);
+		return LEVEL_LLC;
+	}
+
+	if (way >= 0) {
+		cache_line_t *l = cache_line(&llc, set, way);
+		cache_touch(&llc, set, way);
+		if (demand) {
+			llc.hit++;
+			if (l->prefetch) {
+				llc.pf_useful++;
+				l->prefetch = 0;
+				if (miss_class >= 0)
+					llc.shadow->covered[miss_class]++;
+			}
+		}
+		if ((knob_llc_inclusion == INCLUSION_EXCLUSIVE) && (fill_level == FILL_L2)) {
+			// the line moves up, and comes back as an MLC victim later
+			*dirty = l->dirty;
+			l->valid = 0;
+		}
+		return LEVEL_LLC;
+	}
+
+	if (demand)
+		llc.miss++;
+	if (miss_class >= 0)
+		llc.shadow->misses[miss_class]++;
+	dram_reads++;
+
+	if ((knob_llc_inclusion == INCLUSION_EXCLUSIVE) && (fill_level == FILL_L2))
+		return LEVEL_DRAM;
+
+	cache_line_t victim;
+	cache_fill(&llc, line, fill_level == FILL_LLC, &victim);
+	llc_evict(&victim);
+
+	return LEVEL_DRAM;
+}
+
+static void mlc_fill(unsigned long long int line, int prefetch, int dirty)
+{
+	cache_line_t victim;
+	int way = cache_fill(&mlc, line, prefetch, &victim);
+	cache_line(&mlc, cache_get_set(&mlc, line), way)->dirty = dirty;
+	if (victim.valid) {
+		if (victim.dirty)
+			mlc.writeback++;
+		if (knob_llc_inclusion == INCLUSION_EXCLUSIVE)
+			llc_victim_fill(victim.addr, victim.dirty);
+		else if (victim.dirty)
+			llc_writeback(victim.addr);
+	}
+
+	l2_cache_fill(0, line << 6, cache_get_set(&mlc, line), way, prefetch, victim.valid ? (victim.addr << 6) : 0);
+}
+
+static int mlc_access(unsigned long long int addr, unsigned long long int ip, int demand)
+{
+	unsigned long long int line = addr >> 6;
+	int set = cache_get_set(&mlc, line);
+	int way = cache_find(&mlc, line);
+
+	if ((way < 0) && demand && knob_perfect_l2) {
+		// install the line before the prefetcher is told about the hit, and keep an inclusive LLC inclusive
+		mlc_fill(line, 0, llc_install(line, FILL_L2));
+		way = cache_find(&mlc, line);
+	}
+
+	int miss_class = demand ? shadow_access(&mlc, line) : -1;
+
+	if (demand) {
+		mlc.access++;
+		l2_prefetcher_operate(0, addr, ip, way >= 0);
+	}
+
+	if (way >= 0) {
+		cache_touch(&mlc, set, way);
+		if (demand) {
+			mlc.hit++;
+			cache_line_t *l = cache_line(&mlc, set, way);
+			if (l->prefetch) {
+				mlc.pf_useful++;
+				l->prefetch = 0;
+				if (miss_class >= 0)
+					mlc.shadow->covered[miss_class]++;
+			}
+			if (l->oracle) {
+				oracle_useful++;
+				l->oracle = 0;
+				// the fill is still on its way
+				if (l->ready > instructions) {
+					oracle_late++;
+					data_stall_cycles += l->ready - instructions;
+				}
+			}
+		}
+		return LEVEL_MLC;
+	}
+
+	if (demand)
+		mlc.miss++;
+	if (miss_class >= 0)
+		mlc.shadow->misses[miss_class]++;
+
+	int dirty;
+	int level = llc_access(line, demand, FILL_L2, &dirty);
+	mlc_fill(line, 0, dirty);
+	return level;
+}
+
+static int memory_access(unsigned long long int addr, unsigned long long int ip, int type)
+{
+	unsigned long long int line = addr >> 6;
+	int demand = (type != ACCESS_WALK);
+	int set = cache_get_set(&dcu, line);
+	int way = cache_find(&dcu, line);
+	int level = LEVEL_DCU;
+
+	if (demand)
+		dcu.access++;
+
+	if (way >= 0) {
+		cache_touch(&dcu, set, way);
+		if (demand)
+			dcu.hit++;
+	}
+	else {
+		if (demand)
+			dcu.miss++;
+
+		level = mlc_access(addr, ip, demand);
+
+		cache_line_t victim;
+		way = cache_fill(&dcu, line, 0, &victim);
+		if (victim.valid && victim.dirty) {
+			dcu.writeback++;
+			mlc_writeback(victim.addr);
+		}
+	}
+
+	if (type == ACCESS_STORE)
+		cache_line(&dcu, set, way)->dirty = 1;
+
+	if (demand)
+		data_stall_cycles += level_latency[level] - DCU_LATENCY;
+
+	return level;
+}
+
+static void tlb_fill(cache_t *c, unsigned long long int page)
+{
+	cache_line_t victim;
+	cache_fill(c, page, 0, &victim);
+}
+
+static void translate(unsigned long long int addr)
+{
+	unsigned long long int page = addr >> 12;
+	int way = cache_find(&dtlb, page);
+
+	dtlb.access++;
+	if (way >= 0) {
+		dtlb.hit++;
+		cache_touch(&dtlb, cache_get_set(&dtlb, page), way);
+		return;
+	}
+	dtlb.miss++;
+
+	stlb.access++;
+	way = cache_find(&stlb, page);
+	if (way >= 0) {
+		stlb.hit++;
+		cache_touch(&stlb, cache_get_set(&stlb, page), way);
+		stlb_cycles += STLB_LATENCY;
+		tlb_fill(&dtlb, page);
+		return;
+	}
+	stlb.miss++;
+
+	// walk the radix tree from the root, one 8-byte entry per level
+	page_walks++;
+	unsigned long long int cycles = knob_walk_latency;
+	int level;
+	for (level = 0; level < PAGE_WALK_LEVELS; level++) {
+		unsigned long long int index = page >> (9 * (PAGE_WALK_LEVELS - 1 - level));
+		unsigned long long int pte_addr = PAGE_TABLE_BASE + ((unsigned long long int)level << 40) + (index << 3);
+		cycles += level_latency[memory_access(pte_addr, 0, ACCESS_WALK)];
+	}
+	walk_cycles += cycles;
+
+	tlb_fill(&stlb, page);
+	tlb_fill(&dtlb, page);
+}
+
+static void drain_read_queue()
+{
+	int i, dirty;
+	for (i = 0; i < read_queue_occupancy; i++) {
+		unsigned long long int line = read_queue[i].addr >> 6;
+
+		if (read_queue[i].fill_level == FILL_L2) {
+			if (cache_find(&mlc, line) >= 0)
+				continue;
+			llc_access(line, 0, FILL_L2, &dirty);
+			mlc_fill(line, 1, dirty);
+			mlc.pf_fill++;
+		}
+		else {
+			if ((cache_find(&mlc, line) >= 0) || (cache_find(&llc, line) >= 0))
+				continue;
+			llc_access(line, 0, FILL_LLC, &dirty);
+			llc.pf_fill++;
+		}
+		pf_issued++;
+	}
+	read_queue_occupancy = 0;
+}
+
+// Called when rec enters the lookahead window, knob_oracle_distance instructions before it retires.
+static void oracle_prefetch(trace_instr_format_t *rec)
+{
+	unsigned long long int addrs[NUM_INSTR_SOURCES + NUM_INSTR_DESTINATIONS];
+	int i, j, count = 0;
+	for (i = 0; i < NUM_INSTR_SOURCES; i++)
+		addrs[count++] = rec->source_memory[i];
+	for (i = 0; i < NUM_INSTR_DESTINATIONS; i++)
+		addrs[count++] = rec->destination_memory[i];
+
+	for (i = 0; i < count; i++) {
+		unsigned long long int line = addrs[i] >> 6;
+		if (!addrs[i] || (cache_find(&dcu, line) >= 0) || (cache_find(&mlc, line) >= 0))
+			continue;
+		for (j = 0; j < oracle_queue_count; j++)
+			if (oracle_queue[(oracle_queue_head + j) % L2_READ_QUEUE_SIZE] == line)
+				break;
+		if (j < oracle_queue_count)
+			continue;
+		oracle_requested++;
+
+		if (oracle_queue_count == L2_READ_QUEUE_SIZE) {
+			oracle_dropped++;
+			continue;
+		}
+		oracle_queue[(oracle_queue_head + oracle_queue_count) % L2_READ_QUEUE_SIZE] = line;
+		oracle_queue_count++;
+	}
+}
+
+// Issues queued oracle prefetches, oldest first, while an MSHR is free and bandwidth allows.
+static void oracle_issue()
+{
+	while (oracle_queue_count > 0) {
+		unsigned long long int line = oracle_queue[oracle_queue_head];
+
+		// a demand may have fetched the line in the meantime
+		if ((cache_find(&dcu, line) >= 0) || (cache_find(&mlc, line) >= 0)) {
+			oracle_queue_head = (oracle_queue_head + 1) % L2_READ_QUEUE_SIZE;
+			oracle_queue_count--;
+			continue;
+		}
+
+		int mshr;
+		for (mshr = 0; mshr < L2_MSHR_COUNT; mshr++)
+			if (oracle_mshr[mshr] <= instructions)
+				break;
+		if (mshr == L2_MSHR_COUNT)
+			return;
+
+		// only lines read from DRAM use up memory bandwidth
+		int from_dram = (cache_find(&llc, line) < 0);
+		if (from_dram && (oracle_tokens < 1))
+			return;
+
+		oracle_queue_head = (oracle_queue_head + 1) % L2_READ_QUEUE_SIZE;
+		oracle_queue_count--;
+
+		// the linked prefetcher sees the fill like any other it did not ask for
+		int dirty;
+		llc_access(line, 0, FILL_L2, &dirty);
+		mlc_fill(line, 0, dirty);
+		cache_line_t *l = cache_line(&mlc, cache_get_set(&mlc, line), cache_find(&mlc, line));
+		l->oracle = 1;
+		// level_latency counts from the DCU, and the demand still pays the MLC hit on top
+		l->ready = instructions + (from_dram ? DRAM_LATENCY : LLC_LATENCY) - MLC_LATENCY;
+		oracle_mshr[mshr] = l->ready;
+
+		oracle_issued++;
+		if (from_dram) {
+			oracle_dram_reads++;
+			oracle_tokens -= 1;
+		}
+	}
+}
+
+static void demand_access(unsigned long long int addr, unsigned long long int ip, int type)
+{
+	if (knob_tlb)
+		translate(addr);
+	memory_access(addr, ip, type);
+	drain_read_queue();
+}
+
+/*
+  Prefetcher interface, see inc/prefetcher.h
+ */
+
+unsigned long long int get_current_cycle(int cpu_num)
+{
+	return instructions;
+}
+
+int get_l2_mshr_occupancy(int cpu_num)
+{
+	return 0;
+}
+
+int get_l2_read_queue_occupancy(int cpu_num)
+{
+	return read_queue_occupancy;
+}
+
+int l2_prefetch_line(int cpu_num, unsigned long long int base_addr, unsigned long long int pf_addr, int fill_level)
+{
+	pf_requested++;
+
+	if ((base_addr >> 12) != (pf_addr >> 12))
+		return 0;
+	if (read_queue_occupancy >= L2_READ_QUEUE_SIZE)
+		return 0;
+
+	read_queue[read_queue_occupancy].addr = pf_addr;
+	read_queue[read_queue_occupancy].fill_level = (fill_level == FILL_LLC) ? FILL_LLC : FILL_L2;
+	read_queue_occupancy++;
+	return 1;
+}
+
+int l2_get_set(unsigned long long int addr)
+{
+	return cache_get_set(&mlc, addr >> 6);
+}
+
+int l2_get_way(int cpu_num, unsigned long long int addr, int set)
+{
+	unsigned long long int line = addr >> 6;
+	int way;
+	for (way = 0; way < mlc.ways; way++) {
+		cache_line_t *l = cache_line(&mlc, set, way);
+		if (l->valid && l->addr == line)
+			return way;
+	}
+	return -1;
+}
+
+int dtlb_page_resident(int cpu_num, unsigned long long int addr)
+{
+	if (!knob_tlb)
+		return 1;
+	return (cache_find(&dtlb, addr >> 12) >= 0) || (cache_find(&stlb, addr >> 12) >= 0);
+}
+
+/*
+  Statistics
+ */
+
+static double per_kilo(unsigned long long int count)
+{
+	return (stats_instructions == 0) ? 0 : (1000.0 * count / stats_instructions);
+}
+
+static void reset_stats()
+{
+	cache_reset_stats(&dcu);
+	cache_reset_stats(&mlc);
+	cache_reset_stats(&llc);
+	cache_reset_stats(&dtlb);
+	cache_reset_stats(&stlb);
+	stats_instructions = 0;
+	dram_reads = 0;
+	dram_writes = 0;
+	pf_requested = 0;
+	pf_issued = 0;
+	oracle_requested = 0;
+	oracle_dropped = 0;
+	oracle_issued = 0;
+	oracle_dram_reads = 0;
+	oracle_useful = 0;
+	oracle_late = 0;
+	data_stall_cycles = 0;
+	page_walks = 0;
+	walk_cycles = 0;
+	stlb_cycles = 0;
+	back_invalidations = 0;
+	victim_fills = 0;
+	capacity_samples = 0;
+	capacity_lines = 0;
+	memset(interval_last, 0, sizeof(interval_last));
+}
+
+// Appends the counter deltas since the last call to the -interval time series.
+static void interval_record()
+{
+	unsigned long long int totals[INTERVAL_COLUMNS] = {
+		stats_instructions,
+		stats_instructions + data_stall_cycles + walk_cycles + stlb_cycles,
+		mlc.miss,
+		llc.miss,
+		pf_issued,
+		mlc.pf_useful + llc.pf_useful,
+		dram_reads,
+		dram_writes
+	};
+	int c;
+
+	if (totals[0] == interval_last[0])
+		return;
+
+	if (interval_rows == interval_capacity) {
+		interval_capacity = interval_capacity ? 2 * interval_capacity : 1024;
+		for (c = 0; c < INTERVAL_COLUMNS; c++) {
+			interval_columns[c] = realloc(interval_columns[c], interval_capacity * sizeof(unsigned long long int));
+			assert(interval_columns[c] != NULL);
+		}
+	}
+
+	for (c = 0; c < INTERVAL_COLUMNS; c++) {
+		interval_columns[c][interval_rows] = totals[c] - interval_last[c];
+		interval_last[c] = totals[c];
+	}
+	interval_rows++;
+}
+
+static void interval_write(const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	int c, r;
+	if (f == NULL) {
+		perror(path);
+		return;
+	}
+
+	size_t length = strlen(path);
+	if (length >= 4 && !strcmp(path + length - 4, ".csv")) {
+		fprintf(f, "interval");
+		for (c = 0; c < INTERVAL_COLUMNS; c++)
+			fprintf(f, ",%s", interval_column_names[c]);
+		fprintf(f, ",ipc,l2_mpki,llc_mpki,dram_bytes_per_cycle\n");
+
+		for (r = 0; r < interval_rows; r++) {
+			unsigned long long int instr = interval_columns[0][r], cycles = interval_columns[1][r];
+			fprintf(f, "%d", r);
+			for (c = 0; c < INTERVAL_COLUMNS; c++)
+				fprintf(f, ",%llu", interval_columns[c][r]);
+			fprintf(f, ",%f,%f,%f,%f\n", (double)instr / cycles,
+			        1000.0 * interval_columns[2][r] / instr, 1000.0 * interval_columns[3][r] / instr,
+			        (double)CACHE_LINE_SIZE * (interval_columns[6][r] + interval_columns[7][r]) / cycles);
+		}
+	}
+	else {
+		unsigned long long int header[2] = { INTERVAL_COLUMNS, interval_rows };
+		fwrite("DPC2INTV", 1, 8, f);
+		fwrite(header, sizeof(header), 1, f);
+		for (c = 0; c < INTERVAL_COLUMNS; c++)
+			fwrite(interval_column_names[c], 1, strlen(interval_column_names[c]) + 1, f);
+		for (c = 0; c < INTERVAL_COLUMNS; c++)
+			fwrite(interval_columns[c], sizeof(unsigned long long int), interval_rows, f);
+	}
+
+	fclose(f);
+	printf("Wrote %d intervals to %s\n", interval_rows, path);
+}
+
+static void sample_capacity()
+{
+	unsigned long long int lines = 0;
+	int i;
+	for (i = 0; i < llc.sets * llc.ways; i++)
+		if (llc.lines[i].valid)
+			lines++;
+	for (i = 0; i < mlc.sets * mlc.ways; i++)
+		if (mlc.lines[i].valid && (cache_find(&llc, mlc.lines[i].addr) < 0))
+			lines++;
+
+	capacity_samples++;
+	capacity_lines += lines;
+}
+
+static double valid_fraction(cache_t *c)
+{
+	int i, valid = 0;
+	for (i = 0; i < c->sets * c->ways; i++)
+		if (c->lines[i].valid)
+			valid++;
+	return (double)valid / (c->sets * c->ways);
+}
+
+// Samples the caches at a heartbeat, and returns 1 once they have settled.
+static int warmup_converged()
+{
+	cache_t *caches[3] = { &dcu, &mlc, &llc };
+	double *row = warmup_samples[warmup_sample_count % WARMUP_WINDOW];
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		unsigned long long int access = caches[i]->access - warmup_last_access[i];
+		unsigned long long int miss = caches[i]->miss - warmup_last_miss[i];
+		row[2 * i] = (access == 0) ? 0 : ((double)miss / access);
+		row[2 * i + 1] = valid_fraction(caches[i]);
+		warmup_last_access[i] = caches[i]->access;
+		warmup_last_miss[i] = caches[i]->miss;
+	}
+	warmup_sample_count++;
+
+	if (warmup_sample_count < WARMUP_WINDOW)
+		return 0;
+
+	// A cache is only warm once it is full, or has stopped filling: a large LLC can fill so
+	// slowly that its valid fraction stays within the tolerance for a whole window.
+	double *oldest = warmup_samples[warmup_sample_count % WARMUP_WINDOW];
+	for (i = 0; i < 3; i++) {
+		double valid = row[2 * i + 1];
+		double recent_rate = (valid - oldest[2 * i + 1]) / (WARMUP_WINDOW - 1);
+		// every cache starts out empty
+		double overall_rate = valid / warmup_sample_count;
+		if ((valid < 1 - knob_warmup_tolerance) && (recent_rate > knob_warmup_tolerance * overall_rate))
+			return 0;
+	}
+
+	for (j = 0; j < WARMUP_METRICS; j++) {
+		double low = warmup_samples[0][j], high = warmup_samples[0][j];
+		for (i = 1; i < WARMUP_WINDOW; i++) {
+			if (warmup_samples[i][j] < low)
+				low = warmup_samples[i][j];
+			if (warmup_samples[i][j] > high)
+				high = warmup_samples[i][j];
+		}
+		if (high - low > knob_warmup_tolerance)
+			return 0;
+	}
+	return 1;
+}
+
+static void print_cache_stats(cache_t *c)
+{
+	printf("%s accesses: %llu hits: %llu misses: %llu MPKI: %f", c->name, c->access, c->hit, c->miss, per_kilo(c->miss));
+	if (c->pf_fill)
+		printf(" prefetch fills: %llu useful: %llu", c->pf_fill, c->pf_useful);
+	printf("\n");
+}
+
+static void print_miss_classes(cache_t *c)
+{
+	const char *class_names[MISS_CLASS_COUNT] = { "compulsory", "capacity", "conflict" };
+	int i;
+
+	printf("%s misses", c->name);
+	for (i = 0; i < MISS_CLASS_COUNT; i++)
+		printf(" %s: %llu", class_names[i], c->shadow->misses[i]);
+	printf("\n%s prefetch coverage", c->name);
+	for (i = 0; i < MISS_CLASS_COUNT; i++) {
+		unsigned long long int total = c->shadow->misses[i] + c->shadow->covered[i];
+		printf(" %s: %f", class_names[i], (total == 0) ? 0 : ((double)c->shadow->covered[i] / total));
+	}
+	printf("\n");
+}
+
+static void print_stats()
+{
+	print_cache_stats(&dcu);
+	print_cache_stats(&mlc);
+	print_cache_stats(&llc);
+	printf("DRAM reads: %llu writes: %llu\n", dram_reads, dram_writes);
+	printf("Prefetches requested: %llu issued: %llu\n", pf_requested, pf_issued);
+	if (knob_oracle_distance)
+		printf("Oracle prefetches requested: %llu dropped: %llu issued: %llu from DRAM: %llu useful: %llu late: %llu\n",
+		       oracle_requested, oracle_dropped, oracle_issued, oracle_dram_reads, oracle_useful, oracle_late);
+	if (knob_classify_misses) {
+		print_miss_classes(&mlc);
+		print_miss_classes(&llc);
+	}
+	printf("LLC back-invalidations: %llu  victim fills: %llu\n", back_invalidations, victim_fills);
+	if (capacity_samples)
+		printf("Effective MLC+LLC capacity: %.1f KB\n", (double)capacity_lines / capacity_samples * CACHE_LINE_SIZE / 1024);
+
+	// one cycle per instruction plus every stall in full; only meaningful relative to other cache_sim runs
+	unsigned long long int cycles = stats_instructions + data_stall_cycles + walk_cycles + stlb_cycles;
+	printf("Estimated cycles: %llu IPC: %f\n", cycles, (cycles == 0) ? 0 : ((double)stats_instructions / cycles));
+
+	if (knob_tlb) {
+		print_cache_stats(&dtlb);
+		print_cache_stats(&stlb);
+
+		unsigned long long int translation_cycles = walk_cycles + stlb_cycles;
+		unsigned long long int total = translation_cycles + data_stall_cycles;
+		printf("Page walks: %llu  walk cycles: %llu  STLB hit cycles: %llu\n", page_walks, walk_cycles, stlb_cycles);
+		printf("Estimated memory stall cycles: %llu  translation share: %f\n", total,
+		       (total == 0) ? 0 : ((double)translation_cycles / total));
+	}
+}
+
+// Detects memory-only traces, and maps the trace file if it is a regular file, from its current offset on.
+static void trace_open()
+{
+	int fd = fileno(trace_file);
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+
+	trace_prefix_length = fread(trace_prefix, 1, sizeof(trace_prefix), trace_file);
+	if (trace_prefix_length == sizeof(trace_prefix) && !memcmp(trace_prefix, MEMORY_TRACE_MAGIC, sizeof(trace_prefix))) {
+		printf("Reading a memory-only trace\n");
+		memory_trace = 1;
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return;
+	if (offset < 0 || offset % TRACE_RECORD_SIZE != 0)
+		return;
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	trace_map = map;
+	trace_map_length = st.st_size;
+	trace_map_records = st.st_size / TRACE_RECORD_SIZE;
+	trace_map_next = offset / TRACE_RECORD_SIZE;
+}
+
+// Loads the next block of a memory-only trace, and returns 0 at its end.
+static int memory_trace_block()
+{
+	unsigned int count = 0;
+
+	memory_next = 0;
+	memory_count = 0;
+	if (memory_trace_ended)
+		return 0;
+
+	if (fread(&count, sizeof(count), 1, trace_file) != 1 || count == 0 || count > MEMORY_TRACE_BLOCK) {
+		memory_trace_ended = 1;
+		// the end marker is followed by the number of instructions after the last operation
+		if (count != 0 || fread(&memory_skip, sizeof(memory_skip), 1, trace_file) != 1)
+			fprintf(stderr, "Memory-only trace is truncated or corrupt\n");
+		return 0;
+	}
+	if (fread(memory_ip, sizeof(memory_ip[0]), count, trace_file) != count ||
+	    fread(memory_addr, sizeof(memory_addr[0]), count, trace_file) != count ||
+	    fread(memory_gap, sizeof(memory_gap[0]), count, trace_file) != count ||
+	    fread(memory_store, sizeof(memory_store[0]), count, trace_file) != count) {
+		memory_trace_ended = 1;
+		fprintf(stderr, "Memory-only trace is truncated\n");
+		return 0;
+	}
+	memory_count = count;
+	return 1;
+}
+
+// Rebuilds the next instruction record of a memory-only trace.  Instructions without memory
+// operations come back as empty records.
+static int memory_trace_read(trace_instr_format_t *rec)
+{
+	memset(rec, 0, sizeof(*rec));
+	if (memory_skip > 0) {
+		memory_skip--;
+		return 1;
+	}
+	if (memory_next == memory_count && !memory_trace_block()) {
+		if (memory_skip == 0)
+			return 0;
+		memory_skip--;
+		return 1;
+	}
+
+	if (memory_gap[memory_next] > 1) {
+		memory_skip = memory_gap[memory_next] - 2;
+		memory_gap[memory_next] = 1;
+		return 1;
+	}
+
+	rec->ip = memory_ip[memory_next];
+	int loads = 0;
+	do {
+		if (memory_store[memory_next])
+			rec->destination_memory[0] = memory_addr[memory_next];
+		else if (loads < NUM_INSTR_SOURCES)
+			rec->source_memory[loads++] = memory_addr[memory_next];
+		memory_next++;
+	} while ((memory_next < memory_count || memory_trace_block()) && memory_gap[memory_next] == 0);
+	return 1;
+}
+
+// Reads the next trace record, and returns 0 at the end of the trace.
+static int trace_read(trace_instr_format_t *rec)
+{
+	if (memory_trace)
+		return memory_trace_read(rec);
+	if (trace_map != NULL) {
+		if (trace_map_next == trace_map_records)
+			return 0;
+		*rec = trace_map[trace_map_next++];
+		return 1;
+	}
+	if (trace_prefix_length > 0) {
+		size_t length = trace_prefix_length;
+		trace_prefix_length = 0;
+		memcpy(rec, trace_prefix, length);
+		return length == sizeof(trace_prefix) && fread((char *)rec + length, sizeof(*rec) - length, 1, trace_file) == 1;
+	}
+	return fread(rec, sizeof(*rec), 1, trace_file) == 1;
+}
+
+// Parses command line switches, and returns 0 if they are all valid.
+static int parse_options(int argc, char **argv)
+{
+	int i;
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "-small_llc"))
+			knob_small_llc = 1;
+		else if (!strcmp(argv[i], "-low_bandwidth"))
+			knob_low_bandwidth = 1;
+		else if (!strcmp(argv[i], "-scramble_loads"))
+			knob_scramble_loads = 1;
+		else if (!strcmp(argv[i], "-hide_heartbeat"))
+			knob_hide_heartbeat = 1;
+		else if (!strcmp(argv[i], "-tlb"))
+			knob_tlb = 1;
+		else if (!strcmp(argv[i], "-walk_latency") && (i + 1 < argc))
+			knob_walk_latency = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-perfect_l2"))
+			knob_perfect_l2 = 1;
+		else if (!strcmp(argv[i], "-perfect_llc"))
+			knob_perfect_llc = 1;
+		else if (!strcmp(argv[i], "-adaptive_warmup"))
+			knob_adaptive_warmup = 1;
+		else if (!strcmp(argv[i], "-warmup_tolerance") && (i + 1 < argc))
+			knob_warmup_tolerance = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-interval") && (i + 1 < argc))
+			knob_interval = atoll(argv[++i]);
+		else if (!strcmp(argv[i], "-interval_file") && (i + 1 < argc))
+			knob_interval_file = argv[++i];
+		else if (!strcmp(argv[i], "-classify_misses"))
+			knob_classify_misses = 1;
+		else if (!strcmp(argv[i], "-oracle_prefetch") && (i + 1 < argc))
+			knob_oracle_distance = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-llc_inclusion") && (i + 1 < argc)) {
+			i++;
+			if (!strcmp(argv[i], "inclusive"))
+				knob_llc_inclusion = INCLUSION_INCLUSIVE;
+			else if (!strcmp(argv[i], "exclusive"))
+				knob_llc_inclusion = INCLUSION_EXCLUSIVE;
+			else if (!strcmp(argv[i], "nine"))
+				knob_llc_inclusion = INCLUSION_NINE;
+			else {
+				fprintf(stderr, "Unknown LLC inclusion policy: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i], "-warmup_instructions") && (i + 1 < argc))
+			warmup_instructions = atoll(argv[++i]);
+		else if (!strcmp(argv[i], "-simulation_instructions") && (i + 1 < argc))
+			simulation_instructions = atoll(argv[++i]);
+		else {
+			fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Prints the configuration, and sets up the caches, the prefetcher and the trace.
+static void simulation_start()
+{
+	printf("\n*** Data Prefetching Championship 2 Functional Cache Simulator ***\n\n");
+	printf("Warmup Instructions: %s%lld\n", knob_adaptive_warmup ? "adaptive, at most " : "", warmup_instructions);
+	printf("Simulation Instructions: %lld\n", simulation_instructions);
+	printf("Using %s Last Level Cache\n", knob_small_llc ? "256KB" : "1MB");
+	if (knob_tlb)
+		printf("Using DTLB/STLB with %d cycle page walks\n", knob_walk_latency);
+	const char *inclusion_names[] = { "non-inclusive", "inclusive", "exclusive" };
+	printf("Using %s LLC\n", inclusion_names[knob_llc_inclusion]);
+	if (knob_perfect_l2)
+		printf("Perfect L2\n");
+	if (knob_perfect_llc)
+		printf("Perfect LLC\n");
+	if (knob_oracle_distance)
+		printf("Oracle prefetching %d instructions ahead\n", knob_oracle_distance);
+
+	cache_initialize(&dcu, "DCU", DCU_SET_COUNT, DCU_ASSOCIATIVITY);
+	cache_initialize(&mlc, "MLC", L2_SET_COUNT, L2_ASSOCIATIVITY);
+	cache_initialize(&llc, "LLC", knob_small_llc ? SMALL_LLC_SET_COUNT : LLC_SET_COUNT, LLC_ASSOCIATIVITY);
+	cache_initialize(&dtlb, "DTLB", DTLB_SET_COUNT, DTLB_ASSOCIATIVITY);
+	cache_initialize(&stlb, "STLB", STLB_SET_COUNT, STLB_ASSOCIATIVITY);
+	if (knob_classify_misses) {
+		shadow_initialize(&mlc);
+		shadow_initialize(&llc);
+	}
+
+	l2_prefetcher_initialize(0);
+	trace_open();
+
+	window_size = knob_oracle_distance + 1;
+	window = calloc(window_size, sizeof(trace_instr_format_t));
+	assert(window != NULL);
+}
+
+// Simulates the next instruction, and returns 0 once the trace or the simulation has ended.
+static int simulate_instruction()
+{
+	while (window_count < window_size) {
+		trace_instr_format_t *next = &window[(window_head + window_count) % window_size];
+		if (!trace_read(next))
+			break;
+		if (knob_oracle_distance)
+			oracle_prefetch(next);
+		window_count++;
+	}
+	if (window_count == 0)
+		return 0;
+	trace_instr_format_t rec = window[window_head];
+
+	if (!warmup_complete && (warmup_settled || (instructions >= (unsigned long long int)warmup_instructions))) {
+		warmup_complete = 1;
+		printf("\nWarmup complete. Instructions retired: %llu\n", instructions);
+		if (knob_adaptive_warmup)
+			printf("Adaptive warmup ended by %s\n", warmup_settled ? "converged caches" : "reaching -warmup_instructions");
+		l2_prefetcher_warmup_stats(0);
+		reset_stats();
+	}
+	if (warmup_complete && (stats_instructions >= (unsigned long long int)simulation_instructions))
+		return 0;
+
+	window_head = (window_head + 1) % window_size;
+	window_count--;
+	instructions++;
+	stats_instructions++;
+
+	oracle_tokens += (knob_low_bandwidth ? LOW_BANDWIDTH_DRAM_LINES_PER_KILO_CYCLE : DRAM_LINES_PER_KILO_CYCLE) / 1000.0;
+	if (oracle_tokens > L2_READ_QUEUE_SIZE)
+		oracle_tokens = L2_READ_QUEUE_SIZE;
+	if (knob_oracle_distance)
+		oracle_issue();
+
+	int j;
+	for (j = 0; j < NUM_INSTR_SOURCES; j++)
+		if (rec.source_memory[j])
+			demand_access(rec.source_memory[j], rec.ip, ACCESS_LOAD);
+	for (j = 0; j < NUM_INSTR_DESTINATIONS; j++)
+		if (rec.destination_memory[j])
+			demand_access(rec.destination_memory[j], rec.ip, ACCESS_STORE);
+
+	if (instructions % HEARTBEAT_INSTRUCTIONS == 0)
+		sample_capacity();
+	if (knob_interval > 0 && warmup_complete && (stats_instructions % knob_interval == 0))
+		interval_record();
+	if (knob_adaptive_warmup && !warmup_complete && (instructions % HEARTBEAT_INSTRUCTIONS == 0))
+		warmup_settled = warmup_converged();
+	if (!knob_hide_heartbeat && (instructions % HEARTBEAT_INSTRUCTIONS == 0)) {
+		printf("Instructions Retired: %llu MLC MPKI: %f LLC MPKI: %f\n", instructions, per_kilo(mlc.miss), per_kilo(llc.miss));
+		l2_prefetcher_heartbeat_stats(0);
+	}
+	return 1;
+}
+
+// Prints the final statistics.
+static void simulation_end()
+{
+	printf("\nSimulation complete. Instructions retired: %llu\n", stats_instructions);
+	print_stats();
+	if (knob_interval > 0) {
+		// the last interval may be short
+		interval_record();
+		interval_write(knob_interval_file);
+	}
+	printf("\n");
+	l2_prefetcher_final_stats(0);
+}
+
+#ifdef CACHE_SIM_LIBRARY
+
+static int sim_created, sim_ended;
+// zcat process decompressing the trace, or 0
+static pid_t sim_decompressor;
+
+int sim_create(int argc, char **argv, const char *trace_path)
+{
+	if (sim_created)
+		return -1;
+	if (parse_options(argc, argv))
+		return -1;
+
+	size_t length = strlen(trace_path);
+	if (length > 3 && !strcmp(trace_path + length - 3, ".gz")) {
+		// decompress in a child process, like zcat in a shell pipeline
+		int pipe_fds[2];
+		if (pipe(pipe_fds) != 0)
+			return -1;
+		pid_t pid = fork();
+		if (pid < 0)
+			return -1;
+		if (pid == 0) {
+			// the host, Python for one, may ignore SIGPIPE, and zcat should just stop when the simulation does
+			signal(SIGPIPE, SIG_DFL);
+			dup2(pipe_fds[1], STDOUT_FILENO);
+			close(pipe_fds[0]);
+			close(pipe_fds[1]);
+			execlp("zcat", "zcat", trace_path, (char *)NULL);
+			_exit(127);
+		}
+		close(pipe_fds[1]);
+		sim_decompressor = pid;
+		trace_file = fdopen(pipe_fds[0], "r");
+	}
+	else
+		trace_file = fopen(trace_path, "rb");
+	if (trace_file == NULL)
+		return -1;
+
+	sim_created = 1;
+	simulation_start();
+	return 0;
+}
+
+unsigned long long int sim_run(unsigned long long int count)
+{
+	unsigned long long int done = 0;
+	if (!sim_created || sim_ended)
+		return 0;
+	while (done < count && simulate_instruction())
+		done++;
+	if (done < count) {
+		sim_ended = 1;
+		simulation_end();
+		fclose(trace_file);
+		if (sim_decompressor)
+			waitpid(sim_decompressor, NULL, 0);
+	}
+	fflush(stdout);
+	return done;
+}
+
+void sim_get_stats(cache_sim_stats_t *stats)
+{
+	cache_t *levels[3] = { &dcu, &mlc, &llc };
+	int l;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->instructions = instructions;
+	stats->stats_instructions = stats_instructions;
+	stats->warmup_complete = warmup_complete;
+	stats->ended = sim_ended;
+	for (l = 0; l < 3; l++) {
+		stats->access[l] = levels[l]->access;
+		stats->miss[l] = levels[l]->miss;
+		stats->prefetch_fills[l] = levels[l]->pf_fill;
+		stats->prefetch_useful[l] = levels[l]->pf_useful;
+	}
+	stats->prefetches_requested = pf_requested;
+	stats->prefetches_issued = pf_issued;
+	stats->dram_reads = dram_reads;
+	stats->dram_writes = dram_writes;
+	stats->estimated_cycles = stats_instructions + data_stall_cycles + walk_cycles + stlb_cycles;
+}
+
+int sim_interval_rows()
+{
+	return interval_rows;
+}
+
+const char *sim_interval_column_name(int column)
+{
+	return (column >= 0 && column < INTERVAL_COLUMNS) ? interval_column_names[column] : NULL;
+}
+
+const unsigned long long int *sim_interval_column(int column)
+{
+	return (column >= 0 && column < INTERVAL_COLUMNS) ? interval_columns[column] : NULL;
+}
+
+static void cache_free(cache_t *c)
+{
+	free(c->lines);
+	if (c->shadow != NULL) {
+		free(c->shadow->seen.keys);
+		free(c->shadow->fully_associative.nodes);
+		free(c->shadow->fully_associative.buckets);
+		free(c->shadow);
+	}
+}
+
+void sim_destroy()
+{
+	cache_t *caches[5] = { &dcu, &mlc, &llc, &dtlb, &stlb };
+	int c;
+
+	if (!sim_created)
+		return;
+	if (!sim_ended) {
+		// a decompressor still writing the trace stops at the closed pipe
+		fclose(trace_file);
+		if (sim_decompressor)
+			waitpid(sim_decompressor, NULL, 0);
+	}
+	if (trace_map != NULL)
+		munmap((void *)trace_map, trace_map_length);
+	for (c = 0; c < 5; c++)
+		cache_free(caches[c]);
+	free(window);
+	for (c = 0; c < INTERVAL_COLUMNS; c++)
+		free(interval_columns[c]);
+	sim_ended = 1;
+}
+
+#else
+
+int main(int argc, char **argv)
+{
+	if (parse_options(argc - 1, argv + 1))
+		return 1;
+
+	trace_file = stdin;
+	simulation_start();
+	while (simulate_instruction())
+		;
+	simulation_end();
+
+	return 0;
+}
+
+#endif
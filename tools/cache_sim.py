@@ -0,0 +1,128 @@
+#
+# Data Prefetching Championship Simulator 2
+#
+# Python interface to the functional cache simulator (tools/cache_sim.c).
+#
+# Build one shared library per prefetcher, then step simulations in-process:
+#
+#   gcc -O2 -shared -fPIC -DCACHE_SIM_LIBRARY -o cache_sim_fdp.so tools/cache_sim.c src/fdp.c
+#
+#   import sys; sys.path.append("tools")
+#   from cache_sim import CacheSim
+#   sim = CacheSim("./cache_sim_fdp.so", "traces/mcf_trace2.dpc.gz",
+#                  "-small_llc", "-hide_heartbeat", "-interval", "100000")
+#   while sim.run(100000) == 100000:
+#       print(sim.stats()["miss"])
+#   print(sim.intervals()["l2_misses"])
+#   sim.close()
+#
+# The simulator keeps its state in globals, so every CacheSim loads its own
+# copy of the library, and any number of them can exist at once.  close(),
+# or leaving a with block, frees the simulation and unloads and deletes the
+# copy; sweeps over many simulations should not wait for the garbage
+# collector to do it.
+#
+
+import _ctypes
+import ctypes
+import os
+import shutil
+import tempfile
+
+INTERVAL_COLUMNS = 8
+
+
+class _Stats(ctypes.Structure):
+    # mirrors cache_sim_stats_t in inc/cache_sim.h
+    _fields_ = [
+        ("instructions", ctypes.c_ulonglong),
+        ("stats_instructions", ctypes.c_ulonglong),
+        ("warmup_complete", ctypes.c_int),
+        ("ended", ctypes.c_int),
+        ("access", ctypes.c_ulonglong * 3),
+        ("miss", ctypes.c_ulonglong * 3),
+        ("prefetch_fills", ctypes.c_ulonglong * 3),
+        ("prefetch_useful", ctypes.c_ulonglong * 3),
+        ("prefetches_requested", ctypes.c_ulonglong),
+        ("prefetches_issued", ctypes.c_ulonglong),
+        ("dram_reads", ctypes.c_ulonglong),
+        ("dram_writes", ctypes.c_ulonglong),
+        ("estimated_cycles", ctypes.c_ulonglong),
+    ]
+
+
+class CacheSim:
+    """One functional simulation of a trace, with the prefetcher linked into library."""
+
+    def __init__(self, library, trace, *switches):
+        self._lib = None
+        # dlopen() returns the already loaded library for a path it has seen, so load a private copy
+        self._dir = tempfile.mkdtemp(prefix="cache_sim_")
+        path = os.path.join(self._dir, os.path.basename(library))
+        shutil.copy(library, path)
+        self._lib = ctypes.CDLL(path, mode=ctypes.RTLD_LOCAL)
+
+        self._lib.sim_create.argtypes = [ctypes.c_int, ctypes.POINTER(ctypes.c_char_p), ctypes.c_char_p]
+        self._lib.sim_run.argtypes = [ctypes.c_ulonglong]
+        self._lib.sim_run.restype = ctypes.c_ulonglong
+        self._lib.sim_get_stats.argtypes = [ctypes.POINTER(_Stats)]
+        self._lib.sim_interval_column_name.argtypes = [ctypes.c_int]
+        self._lib.sim_interval_column_name.restype = ctypes.c_char_p
+        self._lib.sim_interval_column.argtypes = [ctypes.c_int]
+        self._lib.sim_interval_column.restype = ctypes.POINTER(ctypes.c_ulonglong)
+        self._lib.sim_destroy.argtypes = []
+
+        # the library keeps pointers into argv, so it must outlive the simulation
+        self._argv = (ctypes.c_char_p * len(switches))(*[s.encode() for s in switches])
+        if self._lib.sim_create(len(switches), self._argv, trace.encode()) != 0:
+            self.close()
+            raise ValueError("cannot create a simulation of %s with %s" % (trace, " ".join(switches)))
+
+    def close(self):
+        """Frees the simulation, and unloads and deletes this copy of the library."""
+        if getattr(self, "_lib", None) is not None:
+            self._lib.sim_destroy()
+            _ctypes.dlclose(self._lib._handle)
+            self._lib = None
+        if getattr(self, "_dir", None) is not None:
+            shutil.rmtree(self._dir, ignore_errors=True)
+            self._dir = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def run(self, instructions):
+        """Simulates up to this many instructions, and returns how many it did."""
+        return self._lib.sim_run(instructions)
+
+    def stats(self):
+        """Counters since warmup, as a dict; per-level lists are ordered DCU, MLC, LLC."""
+        s = _Stats()
+        self._lib.sim_get_stats(ctypes.byref(s))
+        return {name: (list(getattr(s, name)) if isinstance(getattr(s, name), ctypes.Array) else getattr(s, name))
+                for name, _ in _Stats._fields_}
+
+    def intervals(self):
+        """The -interval time series, one array per column, as numpy arrays if numpy is installed."""
+        rows = self._lib.sim_interval_rows()
+        try:
+            import numpy
+        except ImportError:
+            numpy = None
+        series = {}
+        for c in range(INTERVAL_COLUMNS):
+            name = self._lib.sim_interval_column_name(c).decode()
+            column = self._lib.sim_interval_column(c)
+            if rows == 0:
+                series[name] = numpy.zeros(0, dtype=numpy.uint64) if numpy else []
+            elif numpy:
+                series[name] = numpy.ctypeslib.as_array(column, shape=(rows,)).copy()
+            else:
+                series[name] = column[:rows]
+        return series
@@ -0,0 +1,272 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  ChampSim trace converter
+
+  Converts ChampSim traces (64-byte input_instr records) to .dpc traces,
+  and back.  The fields map as follows:
+
+    ChampSim                          .dpc
+    ip                                ip
+    is_branch                         destination register REG_INSTRUCTION_POINTER
+    destination_registers[2]          destination_registers[1]
+    source_registers[4]               source_registers[3]
+    destination_memory[2]             destination_memory[1]
+    source_memory[4]                  source_memory[3]
+
+  Both formats number registers like Pin, so register ids are copied as they
+  are.  Fields that do not fit into the smaller .dpc record are dropped,
+  and counted in the summary.  .dpc traces do not record whether a branch
+  was taken, so when converting to ChampSim a branch counts as taken if the
+  next instruction does not follow it within the longest x86 instruction.
+
+  Files ending in .xz or .gz are decompressed and compressed on the fly by
+  xz and gzip (pigz, if installed) running as separate processes, so that
+  reading, converting and writing proceed in parallel; xz compresses with
+  all cores, and takes its level from XZ_OPT (XZ_OPT=-1 is much faster).
+  "-" is stdin or stdout, uncompressed.  To convert a whole corpus, run one
+  converter per file, for example with xargs -P.
+
+  Compile: gcc -Wall -O2 -o champsim_convert tools/champsim_convert.c
+  Usage:   ./champsim_convert -to_dpc <champsim trace> <dpc trace>
+           ./champsim_convert -to_champsim <dpc trace> <champsim trace>
+  Example: ./champsim_convert -to_dpc 605.mcf_s-665B.champsimtrace.xz traces/mcf_665B.dpc.gz
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "../inc/trace.h"
+
+#define CHAMPSIM_DESTINATIONS 2
+#define CHAMPSIM_SOURCES 4
+#define CHAMPSIM_RECORD_SIZE 64
+
+// longest x86 instruction, in bytes
+#define MAX_INSTRUCTION_LENGTH 15
+
+typedef struct champsim_instr
+{
+	unsigned long long int ip;
+
+	unsigned char is_branch;
+	unsigned char branch_taken;
+
+	unsigned char destination_registers[CHAMPSIM_DESTINATIONS];
+	unsigned char source_registers[CHAMPSIM_SOURCES];
+
+	unsigned long long int destination_memory[CHAMPSIM_DESTINATIONS];
+	unsigned long long int source_memory[CHAMPSIM_SOURCES];
+} champsim_instr_t;
+
+typedef char champsim_record_size_check[(sizeof(champsim_instr_t) == CHAMPSIM_RECORD_SIZE) ? 1 : -1];
+
+pid_t children[2];
+int child_count;
+
+unsigned long long int records, branches, taken_branches;
+unsigned long long int dropped_registers, dropped_memory;
+
+int ends_with(const char *s, const char *suffix)
+{
+	size_t length = strlen(s), suffix_length = strlen(suffix);
+	return length >= suffix_length && !strcmp(s + length - suffix_length, suffix);
+}
+
+// Opens path for reading or writing, through a decompressing or compressing process if its
+// name ends in .xz or .gz.
+FILE *open_trace(const char *path, int write)
+{
+	if (!strcmp(path, "-"))
+		return write ? stdout : stdin;
+
+	int fd = write ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	int xz = ends_with(path, ".xz"), gz = ends_with(path, ".gz");
+	if (!xz && !gz)
+		return fdopen(fd, write ? "wb" : "rb");
+
+	int pipe_fds[2];
+	if (pipe(pipe_fds) != 0) {
+		perror("pipe");
+		return NULL;
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(fd, write ? STDOUT_FILENO : STDIN_FILENO);
+		dup2(write ? pipe_fds[0] : pipe_fds[1], write ? STDIN_FILENO : STDOUT_FILENO);
+		close(fd);
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+		if (xz && write)
+			execlp("xz", "xz", "-T0", "-c", (char *)NULL);
+		else if (xz)
+			execlp("xz", "xz", "-dc", (char *)NULL);
+		else if (write) {
+			execlp("pigz", "pigz", "-c", (char *)NULL);
+			execlp("gzip", "gzip", "-c", (char *)NULL);
+		}
+		else
+			execlp("gzip", "gzip", "-dc", (char *)NULL);
+		perror(xz ? "xz" : "gzip");
+		_exit(127);
+	}
+	close(fd);
+	if (pid < 0) {
+		perror("fork");
+		return NULL;
+	}
+	children[child_count++] = pid;
+	close(write ? pipe_fds[0] : pipe_fds[1]);
+	return fdopen(write ? pipe_fds[1] : pipe_fds[0], write ? "wb" : "rb");
+}
+
+// Copies the non-zero values of from[] into to[], and returns how many did not fit.
+int copy_registers(unsigned char *to, int to_count, const unsigned char *from, int from_count)
+{
+	int i, n = 0, dropped = 0;
+	for (i = 0; i < from_count; i++) {
+		if (from[i] == 0)
+			continue;
+		if (n < to_count)
+			to[n++] = from[i];
+		else
+			dropped++;
+	}
+	return dropped;
+}
+
+int copy_addresses(unsigned long long int *to, int to_count, const unsigned long long int *from, int from_count)
+{
+	int i, n = 0, dropped = 0;
+	for (i = 0; i < from_count; i++) {
+		if (from[i] == 0)
+			continue;
+		if (n < to_count)
+			to[n++] = from[i];
+		else
+			dropped++;
+	}
+	return dropped;
+}
+
+void to_dpc(FILE *in, FILE *out)
+{
+	champsim_instr_t c;
+	trace_instr_format_t d;
+
+	while (fread(&c, sizeof(c), 1, in) == 1) {
+		memset(&d, 0, sizeof(d));
+		d.ip = c.ip;
+
+		if (c.is_branch) {
+			// the register slot is what marks a branch in a .dpc trace, so it goes first
+			d.destination_registers[0] = REG_INSTRUCTION_POINTER;
+			branches++;
+			taken_branches += c.branch_taken;
+			int i;
+			for (i = 0; i < CHAMPSIM_DESTINATIONS; i++)
+				if (c.destination_registers[i] != 0 && c.destination_registers[i] != REG_INSTRUCTION_POINTER)
+					dropped_registers++;
+		}
+		else
+			dropped_registers += copy_registers(d.destination_registers, NUM_INSTR_DESTINATIONS, c.destination_registers, CHAMPSIM_DESTINATIONS);
+		dropped_registers += copy_registers(d.source_registers, NUM_INSTR_SOURCES, c.source_registers, CHAMPSIM_SOURCES);
+		dropped_memory += copy_addresses(d.destination_memory, NUM_INSTR_DESTINATIONS, c.destination_memory, CHAMPSIM_DESTINATIONS);
+		dropped_memory += copy_addresses(d.source_memory, NUM_INSTR_SOURCES, c.source_memory, CHAMPSIM_SOURCES);
+
+		fwrite(&d, sizeof(d), 1, out);
+		records++;
+	}
+}
+
+void write_champsim(FILE *out, trace_instr_format_t *d, trace_instr_format_t *next)
+{
+	champsim_instr_t c;
+	memset(&c, 0, sizeof(c));
+	c.ip = d->ip;
+
+	int i;
+	for (i = 0; i < NUM_INSTR_DESTINATIONS; i++)
+		if (d->destination_registers[i] == REG_INSTRUCTION_POINTER)
+			c.is_branch = 1;
+	if (c.is_branch) {
+		branches++;
+		// without a next instruction, assume the common case of a taken branch
+		c.branch_taken = (next == NULL) || (next->ip < d->ip) || (next->ip > d->ip + MAX_INSTRUCTION_LENGTH);
+		taken_branches += c.branch_taken;
+	}
+
+	copy_registers(c.destination_registers, CHAMPSIM_DESTINATIONS, d->destination_registers, NUM_INSTR_DESTINATIONS);
+	copy_registers(c.source_registers, CHAMPSIM_SOURCES, d->source_registers, NUM_INSTR_SOURCES);
+	copy_addresses(c.destination_memory, CHAMPSIM_DESTINATIONS, d->destination_memory, NUM_INSTR_DESTINATIONS);
+	copy_addresses(c.source_memory, CHAMPSIM_SOURCES, d->source_memory, NUM_INSTR_SOURCES);
+
+	fwrite(&c, sizeof(c), 1, out);
+	records++;
+}
+
+void to_champsim(FILE *in, FILE *out)
+{
+	trace_instr_format_t current, next;
+
+	// whether a branch was taken depends on the instruction after it
+	if (fread(&current, sizeof(current), 1, in) != 1)
+		return;
+	while (fread(&next, sizeof(next), 1, in) == 1) {
+		write_champsim(out, &current, &next);
+		current = next;
+	}
+	write_champsim(out, &current, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 4 || (strcmp(argv[1], "-to_dpc") && strcmp(argv[1], "-to_champsim"))) {
+		fprintf(stderr, "Usage: %s -to_dpc <champsim trace> <dpc trace>\n"
+		        "       %s -to_champsim <dpc trace> <champsim trace>\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	FILE *in = open_trace(argv[2], 0);
+	FILE *out = open_trace(argv[3], 1);
+	if (in == NULL || out == NULL)
+		return 1;
+
+	// large buffers keep the pipes to the compression processes busy
+	setvbuf(in, NULL, _IOFBF, 1 << 20);
+	setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+	if (!strcmp(argv[1], "-to_dpc"))
+		to_dpc(in, out);
+	else
+		to_champsim(in, out);
+
+	int failed = ferror(in) || (fclose(out) != 0);
+	fclose(in);
+	int i;
+	for (i = 0; i < child_count; i++) {
+		int status;
+		waitpid(children[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed = 1;
+	}
+
+	fprintf(stderr, "%llu instructions, %llu branches (%llu taken)", records, branches, taken_branches);
+	if (dropped_registers || dropped_memory)
+		fprintf(stderr, ", dropped %llu register and %llu memory operands", dropped_registers, dropped_memory);
+	fprintf(stderr, "\n");
+	if (failed)
+		fprintf(stderr, "Conversion failed\n");
+	return failed;
+}
@@ -0,0 +1,120 @@
+#!/bin/bash
+#
+# Data Prefetching Championship Simulator 2
+#
+# Runs the simulator until the IPC measured since warmup has converged, and
+# stops it early instead of always running -simulation_instructions.
+#
+# After warmup, heartbeats are grouped into batches, and the CPI of every
+# batch is one sample (batch means, which hides most of the correlation
+# between neighbouring heartbeats).  Once at least -min_instructions have been
+# simulated, the run stops as soon as the 95% confidence interval of the mean
+# CPI is narrower than -relative_error of the mean.
+#
+# Usage: tools/converge.sh <dpc2sim binary> <trace.dpc.gz> [options] [simulator switches]
+#
+# Options:
+#   -relative_error <x>       target half-width of the 95% interval, relative to IPC (default 0.01)
+#   -min_instructions <N>     never stop before this many instructions after warmup (default 1,000,000)
+#   -batch_heartbeats <N>     heartbeats per batch (default 5)
+#
+# -simulation_instructions still caps the run.  Any other switch is passed on
+# to the simulator.  -hide_heartbeat is ignored, since heartbeats are needed.
+#
+# Example:
+#   tools/converge.sh ./dpc2sim traces/libquantum_trace2.dpc.gz -relative_error 0.02
+#
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 <dpc2sim binary> <trace.dpc.gz> [options] [simulator switches]" >&2
+  exit 1
+fi
+
+simulator=$1
+trace=$2
+shift 2
+
+relative_error=0.01
+min_instructions=1000000
+batch_heartbeats=5
+switches=()
+
+while [ $# -gt 0 ]; do
+  case $1 in
+    -relative_error) relative_error=$2; shift ;;
+    -min_instructions) min_instructions=$2; shift ;;
+    -batch_heartbeats) batch_heartbeats=$2; shift ;;
+    -hide_heartbeat) ;;
+    *) switches+=("$1") ;;
+  esac
+  shift
+done
+
+case $trace in
+  *.gz) reader=(zcat "$trace") ;;
+  *) reader=(cat "$trace") ;;
+esac
+
+# When awk exits, the simulator is killed by SIGPIPE at its next heartbeat.
+"${reader[@]}" | stdbuf -oL "$simulator" "${switches[@]}" | awk \
+  -v target="$relative_error" -v min_instructions="$min_instructions" -v batch_heartbeats="$batch_heartbeats" '
+  BEGIN {
+    # two-sided 95% quantiles of Student t with 1 .. 30 degrees of freedom
+    split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 " \
+          "2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 2.093 2.086 " \
+          "2.080 2.074 2.069 2.064 2.060 2.056 2.052 2.048 2.045 2.042", t_table, " ");
+  }
+  # half-width of the 95% confidence interval of the mean batch CPI, relative to the mean
+  function relative_error() {
+    mean = sum / n;
+    variance = (sum2 - n * mean * mean) / (n - 1);
+    if (variance < 0)
+      variance = 0;
+    # Student t with n - 1 degrees of freedom; 1.96 + 2.4 / df is within 0.003 of it beyond the table
+    df = n - 1;
+    t = (df <= 30) ? t_table[df] : 1.96 + 2.4 / df;
+    return t * sqrt(variance / n) / mean;
+  }
+  function report(reason) {
+    error = (n > 1) ? relative_error() : -1;
+    printf("\n%s. Instructions simulated: %d Cycles elapsed: %d IPC: %f\n",
+      reason, instructions - base_instructions, cycles - base_cycles,
+      (cycles > base_cycles) ? (instructions - base_instructions) / (cycles - base_cycles) : 0);
+    if (error < 0)
+      printf("Too few batches for a confidence interval (%d)\n", n);
+    else
+      printf("95%% confidence: IPC within %.3f%% (%d batches of %d heartbeats)\n", 100 * error, n, batch_heartbeats);
+  }
+  /^Warmup complete/ {
+    warm = 1;
+    base_instructions = batch_instructions = instructions = $5;
+    base_cycles = batch_cycles = cycles = $8;
+    print;
+    next;
+  }
+  /^Instructions Retired:/ && warm && $3 > instructions {
+    instructions = $3;
+    cycles = $5;
+    if (++heartbeats % batch_heartbeats == 0) {
+      cpi = (cycles - batch_cycles) / (instructions - batch_instructions);
+      n++;
+      sum += cpi;
+      sum2 += cpi * cpi;
+      batch_instructions = instructions;
+      batch_cycles = cycles;
+
+      if (n > 1 && instructions - base_instructions >= min_instructions && relative_error() <= target) {
+        report("Converged");
+        exit;
+      }
+    }
+    next;
+  }
+  /^Simulation complete/ {
+    instructions = base_instructions + $5;
+    cycles = base_cycles + $8;
+    print;
+    report("Did not converge before the end of simulation");
+    exit;
+  }
+  /^(Warmup|Simulation) Instructions:|^Using|^Scramble/ { print }'
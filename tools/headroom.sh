@@ -0,0 +1,64 @@
+#!/bin/bash
+#
+# Data Prefetching Championship Simulator 2
+#
+# Reports how much of the attainable speedup a prefetcher achieves on one trace.
+# The prefetcher, no prefetching, and an upper bound are all run through the
+# functional cache simulator (tools/cache_sim.c), and their estimated IPCs
+# are compared:
+#
+#   fraction = (prefetcher IPC - baseline IPC) / (bound IPC - baseline IPC)
+#
+# Usage: tools/headroom.sh <prefetcher.c> <trace.dpc.gz> <bound> [cache_sim options]
+#   <bound> is one of -perfect_l2, -perfect_llc, or -oracle_prefetch=<distance>
+#
+# The trace is decompressed once, through tools/trace_cache.sh.
+#
+# Example:
+#   tools/headroom.sh src/fdp.c traces/mcf_trace2.dpc.gz -perfect_l2 -small_llc
+#
+
+if [ $# -lt 3 ]; then
+  echo "Usage: $0 <prefetcher.c> <trace.dpc.gz> <bound> [cache_sim options]" >&2
+  exit 1
+fi
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+prefetcher=$1
+trace=$2
+bound=${3/=/ }
+shift 3
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+trace=$("$root/tools/trace_cache.sh" "$trace") || exit 1
+
+gcc -O2 -o "$work/with_prefetcher" "$root/tools/cache_sim.c" "$prefetcher" || exit 1
+gcc -O2 -o "$work/no_prefetcher" "$root/tools/cache_sim.c" "$root/example_prefetchers/skeleton.c" || exit 1
+
+estimated_ipc() {
+  local binary=$1
+  shift
+  "$work/$binary" -hide_heartbeat "$@" < "$trace" | awk '/^Estimated cycles:/ { print $5 }'
+}
+
+# the three runs are independent, so let them share the machine
+estimated_ipc no_prefetcher "$@" > "$work/baseline" &
+estimated_ipc with_prefetcher "$@" > "$work/prefetcher" &
+estimated_ipc no_prefetcher $bound "$@" > "$work/bound" &
+wait
+
+baseline=$(cat "$work/baseline")
+with_prefetcher=$(cat "$work/prefetcher")
+upper=$(cat "$work/bound")
+
+echo "Baseline IPC: $baseline"
+echo "Prefetcher IPC: $with_prefetcher"
+echo "Bound IPC ($bound): $upper"
+awk -v b="$baseline" -v p="$with_prefetcher" -v u="$upper" 'BEGIN {
+  if (u - b <= 0)
+    print "Fraction of attainable speedup: n/a (no headroom)";
+  else
+    printf("Fraction of attainable speedup: %f\n", (p - b) / (u - b));
+}'
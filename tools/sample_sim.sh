@@ -0,0 +1,163 @@
+#!/bin/bash
+#
+# Data Prefetching Championship Simulator 2
+#
+# Sampled simulation of a single long trace.  The simulation region is split
+# into intervals that run concurrently, each in its own simulator process.
+# Every interval starts reading the trace shortly before its own start point,
+# and uses the instructions just before it as warmup.  The intervals' CPIs
+# are combined into one weighted IPC with a 95% confidence interval.
+#
+# Usage: tools/sample_sim.sh <dpc2sim binary> <trace> [options] [simulator switches]
+#
+# Options:
+#   -parallel_samples <K>          split the region into K equal intervals (default 4)
+#   -regions <file>                simulate the weighted regions listed in <file>, one
+#                                  "<start> <length> <weight>" line each, instead of
+#                                  splitting a region (see tools/simpoint.c)
+#   -start_instruction <N>         first instruction of the region (default 0)
+#   -simulation_instructions <N>   length of the region (default 100,000,000)
+#   -warmup_instructions <N>       warmup before each interval (default 10,000,000)
+#   -jobs <N>                      intervals simulated at once (default: number of CPUs)
+#
+# Any other switch, like -small_llc, is passed on to the simulator.
+# <trace> can be a .dpc file, which is read from each interval's start point
+# directly, or a .dpc.gz file, which is first decompressed once through
+# tools/trace_cache.sh.
+#
+# Example:
+#   tools/sample_sim.sh ./dpc2sim traces/mcf_trace2.dpc.gz -parallel_samples 3 \
+#     -simulation_instructions 3000000 -warmup_instructions 100000
+#
+
+TRACE_RECORD_SIZE=48
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 <dpc2sim binary> <trace> [options] [simulator switches]" >&2
+  exit 1
+fi
+
+simulator=$1
+trace=$2
+shift 2
+
+samples=4
+start=0
+length=100000000
+warmup=10000000
+jobs=$(nproc 2>/dev/null || echo 1)
+regions=
+switches=()
+
+while [ $# -gt 0 ]; do
+  case $1 in
+    -parallel_samples) samples=$2; shift ;;
+    -regions) regions=$2; shift ;;
+    -start_instruction) start=$2; shift ;;
+    -simulation_instructions) length=$2; shift ;;
+    -warmup_instructions) warmup=$2; shift ;;
+    -jobs) jobs=$2; shift ;;
+    *) switches+=("$1") ;;
+  esac
+  shift
+done
+
+trace=$("$(dirname "$0")/trace_cache.sh" "$trace") || exit 1
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# Writes the trace to stdout, starting at record $1.
+read_trace_from() {
+  local skip_bytes=$(($1 * TRACE_RECORD_SIZE))
+  tail -c +$((skip_bytes + 1)) "$trace"
+}
+
+# Simulates one interval; the region file has one "start length weight" line per interval.
+run_interval() {
+  local index=$1 interval_start=$2 interval_length=$3
+  local interval_warmup=$warmup
+  if [ "$interval_warmup" -gt "$interval_start" ]; then
+    interval_warmup=$interval_start
+  fi
+
+  read_trace_from $((interval_start - interval_warmup)) |
+    "$simulator" -hide_heartbeat -warmup_instructions "$interval_warmup" \
+      -simulation_instructions "$interval_length" "${switches[@]}" > "$work/interval_$index.out"
+}
+
+# Runs every interval listed in $1, and prints the weighted IPC.
+# The confidence interval is only printed if $2 is 1, since it assumes the
+# intervals are samples of one population rather than distinct phases.
+run_regions() {
+  local regions=$1 confidence=$2 index=0
+  while read -r interval_start interval_length weight; do
+    while [ "$(jobs -rp | wc -l)" -ge "$jobs" ]; do
+      wait -n
+    done
+    run_interval $index "$interval_start" "$interval_length" &
+    index=$((index + 1))
+  done < "$regions"
+  wait
+
+  index=0
+  while read -r interval_start interval_length weight; do
+    if ! grep -q '^Simulation complete' "$work/interval_$index.out"; then
+      echo "Interval $index (instruction $interval_start) did not complete" >&2
+      exit 1
+    fi
+    awk -v w="$weight" -v s="$interval_start" -v n="$interval_length" \
+      '/^Simulation complete/ { print s, n, w, $5, $8 }' "$work/interval_$index.out"
+    index=$((index + 1))
+  done < "$regions" > "$work/results"
+
+  awk -v confidence="$confidence" '
+    { start[NR] = $1; weight[NR] = $3; retired[NR] = $4; cycles[NR] = $5; cpi[NR] = $5 / $4 }
+    END {
+      for (i = 1; i <= NR; i++) {
+        printf("Interval %d: start %d instructions %d weight %f IPC %f\n", i - 1, start[i], retired[i], weight[i], 1 / cpi[i]);
+        wsum += weight[i];
+      }
+      for (i = 1; i <= NR; i++) {
+        w = weight[i] / wsum;
+        mean += w * cpi[i];
+        w2 += w * w;
+      }
+      for (i = 1; i <= NR; i++) {
+        w = weight[i] / wsum;
+        var += w * w * (cpi[i] - mean) ^ 2;
+      }
+      # variance of a weighted mean of independent samples
+      se = (w2 < 1) ? sqrt(var / (1 - w2)) : 0;
+      printf("\nWeighted IPC: %f\n", 1 / mean);
+      if (!confidence)
+        exit;
+      if (NR < 2) {
+        printf("95%% confidence interval: needs at least 2 samples\n");
+        exit;
+      }
+      # two-sided 95% quantile of Student t with NR - 1 degrees of freedom;
+      # 1.96 + 2.4 / df is within 0.003 of it beyond the table
+      split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 " \
+            "2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 2.093 2.086 " \
+            "2.080 2.074 2.069 2.064 2.060 2.056 2.052 2.048 2.045 2.042", t_table, " ");
+      df = NR - 1;
+      t = (df <= 30) ? t_table[df] : 1.96 + 2.4 / df;
+      low = 1 / (mean + t * se);
+      high = (mean > t * se) ? sprintf("%f", 1 / (mean - t * se)) : "inf";
+      printf("95%% confidence interval: %f - %s (relative error %.2f%%)\n", low, high, 100 * t * se / mean);
+    }' "$work/results"
+}
+
+if [ -n "$regions" ]; then
+  grep -v '^[[:space:]]*\(#\|$\)' "$regions" > "$work/regions"
+  confidence=0
+else
+  interval_length=$((length / samples))
+  for ((k = 0; k < samples; k++)); do
+    echo "$((start + k * interval_length)) $interval_length 1"
+  done > "$work/regions"
+  confidence=1
+fi
+
+run_regions "$work/regions" $confidence
@@ -0,0 +1,87 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Client for the local simulation server (tools/sim_server.c)
+
+  Submits one job and prints the server's JSON replies as they arrive.
+  Relative paths are made absolute before they are sent.  The exit status is
+  the simulator's, or 1 if the job could not run.
+
+  Compile: gcc -Wall -O2 -o sim_client tools/sim_client.c
+  Usage:   ./sim_client [-socket path] <simulator binary> <trace> [simulator switches]
+
+  Example:
+    ./sim_client ./dpc2sim_fdp traces/mcf_trace2.dpc.gz -small_llc -hide_heartbeat
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int main(int argc, char **argv)
+{
+	char default_path[108];
+	snprintf(default_path, sizeof(default_path), "/tmp/dpc2sim-%d.sock", (int)getuid());
+	const char *socket_path = default_path;
+
+	int first = 1;
+	if (argc > 2 && !strcmp(argv[1], "-socket")) {
+		socket_path = argv[2];
+		first = 3;
+	}
+	if (argc - first < 2) {
+		fprintf(stderr, "Usage: %s [-socket path] <simulator binary> <trace> [simulator switches]\n", argv[0]);
+		return 1;
+	}
+
+	char simulator[PATH_MAX], trace[PATH_MAX];
+	if (realpath(argv[first], simulator) == NULL) {
+		perror(argv[first]);
+		return 1;
+	}
+	if (realpath(argv[first + 1], trace) == NULL) {
+		perror(argv[first + 1]);
+		return 1;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", socket_path);
+		return 1;
+	}
+	strcpy(address.sun_path, socket_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		perror(socket_path);
+		return 1;
+	}
+
+	FILE *server = fdopen(fd, "r+");
+	fprintf(server, "%s %s", simulator, trace);
+	int i;
+	for (i = first + 2; i < argc; i++)
+		fprintf(server, " %s", argv[i]);
+	fprintf(server, "\n");
+	fflush(server);
+	shutdown(fd, SHUT_WR);
+
+	int status = 1;
+	char line[4096];
+	while (fgets(line, sizeof(line), server) != NULL) {
+		fputs(line, stdout);
+		fflush(stdout);
+		sscanf(line, "{\"event\":\"exit\",\"job\":%*u,\"status\":%d}", &status);
+	}
+	fclose(server);
+	return status;
+}
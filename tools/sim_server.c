@@ -0,0 +1,416 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Local simulation server
+
+  Accepts simulation jobs over a Unix domain socket and streams their
+  results back as JSON, one object per line.  A job is one line of
+  whitespace-separated words:
+
+    <simulator binary> <trace> [simulator switches]
+
+  where the simulator is a DPC2 Simulator (or tools/cache_sim.c) binary
+  linked with the prefetcher under test, and both paths are absolute.
+  tools/sim_client.c submits jobs and prints the replies.
+
+  Decompressed traces are kept in memory by the server: the first job on a
+  trace decompresses it into an anonymous in-memory file, and every later
+  job reads that file as its stdin, so no job pays for decompression.  Once
+  the traces take more than -cache_mb megabytes, the least recently used
+  ones that no job is reading are dropped.
+
+  The simulator keeps its state in globals inside lib/dpc2sim.a, so jobs
+  cannot share a process; each job runs in its own child process, and at
+  most -workers of them run at once.  Further jobs wait for a free worker.
+
+  Replies, in order:
+    {"event":"start","job":N}
+    {"event":"warmup","instructions":N,"cycles":N,"ipc":X}
+    {"event":"heartbeat","instructions":N,"cycles":N,"ipc":X,"cumulative_ipc":X}
+    {"event":"complete","instructions":N,"cycles":N,"ipc":X}
+    {"event":"estimate","cycles":N,"ipc":X}  from tools/cache_sim.c
+    {"event":"output","text":"..."}         every other line the simulator prints
+    {"event":"exit","job":N,"status":N}     the simulator's exit status, last
+  or a single {"event":"error","message":"..."} if the job could not start.
+
+  Compile: gcc -Wall -O2 -pthread -o sim_server tools/sim_server.c
+  Usage:   ./sim_server [-socket path] [-workers N] [-cache_mb N]
+
+  The socket is only accessible to the user running the server, since jobs
+  name the binary it executes.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define MAX_JOB_LENGTH 4096
+#define MAX_JOB_WORDS 128
+
+#define TRACE_LOADING -1
+#define TRACE_FAILED -2
+
+const char *socket_path;
+int workers;
+long long int cache_bytes = 4096LL << 20;
+
+typedef struct cached_trace
+{
+	char *path;
+	// in-memory file holding the decompressed trace, TRACE_LOADING or TRACE_FAILED before that
+	int fd;
+	long long int size;
+	int readers;
+	unsigned long long int last_use;
+	struct cached_trace *next;
+} cached_trace_t;
+
+cached_trace_t *traces;
+unsigned long long int use_clock;
+int busy_workers;
+unsigned long long int job_count;
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+
+// Writes the decompressed trace at path into fd, and returns its size, or -1 on failure.
+long long int decompress(const char *path, int fd)
+{
+	size_t length = strlen(path);
+	int compressed = (length > 3 && !strcmp(path + length - 3, ".gz"));
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int in = open(path, O_RDONLY);
+		if (in < 0)
+			_exit(127);
+		dup2(in, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		if (compressed)
+			execlp("zcat", "zcat", (char *)NULL);
+		else
+			execlp("cat", "cat", (char *)NULL);
+		_exit(127);
+	}
+	int status;
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		return -1;
+	return st.st_size;
+}
+
+// Drops least recently used traces nobody reads until the cache fits.  Called with lock held.
+void evict()
+{
+	while (1) {
+		long long int total = 0;
+		cached_trace_t *t, *victim = NULL;
+		for (t = traces; t != NULL; t = t->next) {
+			total += t->size;
+			if (t->fd >= 0 && t->readers == 0 && (victim == NULL || t->last_use < victim->last_use))
+				victim = t;
+		}
+		if (total <= cache_bytes || victim == NULL)
+			return;
+
+		cached_trace_t **p = &traces;
+		while (*p != victim)
+			p = &(*p)->next;
+		*p = victim->next;
+		close(victim->fd);
+		free(victim->path);
+		free(victim);
+	}
+}
+
+// Returns the cached trace for path, decompressing it first if needed, or NULL on failure.
+// The caller must release it with release_trace().
+cached_trace_t *acquire_trace(const char *path)
+{
+	pthread_mutex_lock(&lock);
+	cached_trace_t *t;
+	for (t = traces; t != NULL; t = t->next)
+		if (!strcmp(t->path, path))
+			break;
+
+	if (t == NULL) {
+		t = calloc(1, sizeof(cached_trace_t));
+		t->path = strdup(path);
+		t->fd = TRACE_LOADING;
+		t->next = traces;
+		traces = t;
+		t->readers++;
+		pthread_mutex_unlock(&lock);
+
+		// decompress without the lock, so jobs on other traces are not held up
+		int fd = memfd_create("dpc2_trace", MFD_CLOEXEC);
+		long long int size = (fd < 0) ? -1 : decompress(path, fd);
+
+		pthread_mutex_lock(&lock);
+		if (size < 0) {
+			if (fd >= 0)
+				close(fd);
+			// forget the trace, so the next job tries again
+			cached_trace_t **p = &traces;
+			while (*p != t)
+				p = &(*p)->next;
+			*p = t->next;
+			t->fd = TRACE_FAILED;
+		}
+		else {
+			t->fd = fd;
+			t->size = size;
+		}
+		pthread_cond_broadcast(&changed);
+	}
+	else {
+		t->readers++;
+		while (t->fd == TRACE_LOADING)
+			pthread_cond_wait(&changed, &lock);
+	}
+
+	if (t->fd == TRACE_FAILED) {
+		// the last job waiting for a failed trace frees it
+		if (--t->readers == 0) {
+			free(t->path);
+			free(t);
+		}
+		pthread_mutex_unlock(&lock);
+		return NULL;
+	}
+	t->last_use = ++use_clock;
+	evict();
+	pthread_mutex_unlock(&lock);
+	return t;
+}
+
+void release_trace(cached_trace_t *t)
+{
+	pthread_mutex_lock(&lock);
+	t->readers--;
+	evict();
+	pthread_mutex_unlock(&lock);
+}
+
+void reply(FILE *out, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(out, format, args);
+	va_end(args);
+	fputc('\n', out);
+	fflush(out);
+}
+
+// Replies with one line of simulator output, as a result event if it is one.
+void reply_line(FILE *out, char *line)
+{
+	unsigned long long int instructions, cycles;
+	double ipc, cumulative_ipc;
+
+	line[strcspn(line, "\n")] = '\0';
+	if (line[0] == '\0')
+		return;
+
+	if (sscanf(line, "Instructions Retired: %llu Cycle: %llu Hearbeat IPC: %lf Cumulative IPC: %lf",
+	           &instructions, &cycles, &ipc, &cumulative_ipc) == 4)
+		reply(out, "{\"event\":\"heartbeat\",\"instructions\":%llu,\"cycles\":%llu,\"ipc\":%f,\"cumulative_ipc\":%f}",
+		      instructions, cycles, ipc, cumulative_ipc);
+	else if (sscanf(line, "Warmup complete. Instructions retired: %llu Cycles elapsed: %llu IPC: %lf", &instructions, &cycles, &ipc) == 3)
+		reply(out, "{\"event\":\"warmup\",\"instructions\":%llu,\"cycles\":%llu,\"ipc\":%f}", instructions, cycles, ipc);
+	else if (sscanf(line, "Simulation complete. Instructions retired: %llu Cycles elapsed: %llu IPC: %lf", &instructions, &cycles, &ipc) == 3)
+		reply(out, "{\"event\":\"complete\",\"instructions\":%llu,\"cycles\":%llu,\"ipc\":%f}", instructions, cycles, ipc);
+	else if (sscanf(line, "Estimated cycles: %llu IPC: %lf", &cycles, &ipc) == 2)
+		reply(out, "{\"event\":\"estimate\",\"cycles\":%llu,\"ipc\":%f}", cycles, ipc);
+	else {
+		fputs("{\"event\":\"output\",\"text\":\"", out);
+		char *c;
+		for (c = line; *c; c++) {
+			if (*c == '"' || *c == '\\')
+				fprintf(out, "\\%c", *c);
+			else if ((unsigned char)*c < 0x20)
+				fprintf(out, "\\u%04x", *c);
+			else
+				fputc(*c, out);
+		}
+		fputs("\"}\n", out);
+		fflush(out);
+	}
+}
+
+void run_job(FILE *out, char **words, int word_count)
+{
+	if (word_count < 2 || words[0][0] != '/' || words[1][0] != '/') {
+		reply(out, "{\"event\":\"error\",\"message\":\"expected: <simulator binary> <trace> [switches], with absolute paths\"}");
+		return;
+	}
+
+	cached_trace_t *trace = acquire_trace(words[1]);
+	if (trace == NULL) {
+		reply(out, "{\"event\":\"error\",\"message\":\"cannot read the trace\"}");
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	while (busy_workers == workers)
+		pthread_cond_wait(&changed, &lock);
+	busy_workers++;
+	unsigned long long int job = ++job_count;
+	pthread_mutex_unlock(&lock);
+
+	int output[2];
+	pid_t pid = -1;
+	if (pipe2(output, O_CLOEXEC) == 0) {
+		pid = fork();
+		if (pid == 0) {
+			// a fresh open of the in-memory file, so every job reads it from its own offset
+			char fd_path[64];
+			snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", trace->fd);
+			int in = open(fd_path, O_RDONLY);
+			if (in < 0)
+				_exit(127);
+			dup2(in, STDIN_FILENO);
+			if (in != STDIN_FILENO)
+				close(in);
+			dup2(output[1], STDOUT_FILENO);
+			dup2(output[1], STDERR_FILENO);
+			words[1] = words[0];
+			execv(words[0], &words[1]);
+			_exit(127);
+		}
+		close(output[1]);
+		if (pid < 0)
+			close(output[0]);
+	}
+
+	if (pid < 0)
+		reply(out, "{\"event\":\"error\",\"message\":\"cannot start the simulator: %s\"}", strerror(errno));
+	else {
+		reply(out, "{\"event\":\"start\",\"job\":%llu}", job);
+		FILE *in = fdopen(output[0], "r");
+		char line[MAX_JOB_LENGTH];
+		while (fgets(line, sizeof(line), in) != NULL)
+			reply_line(out, line);
+		fclose(in);
+
+		int status = 0;
+		waitpid(pid, &status, 0);
+		reply(out, "{\"event\":\"exit\",\"job\":%llu,\"status\":%d}", job, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+	}
+
+	pthread_mutex_lock(&lock);
+	busy_workers--;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+	release_trace(trace);
+}
+
+void *serve_connection(void *arg)
+{
+	int fd = (int)(long)arg;
+	FILE *in = fdopen(fd, "r");
+	FILE *out = fdopen(dup(fd), "w");
+	char job[MAX_JOB_LENGTH];
+
+	// one job per line, until the client closes the connection
+	while (fgets(job, sizeof(job), in) != NULL) {
+		char *words[MAX_JOB_WORDS + 1];
+		int word_count = 0;
+		char *save;
+		char *word = strtok_r(job, " \t\r\n", &save);
+		while (word != NULL && word_count < MAX_JOB_WORDS) {
+			words[word_count++] = word;
+			word = strtok_r(NULL, " \t\r\n", &save);
+		}
+		words[word_count] = NULL;
+		if (word_count > 0)
+			run_job(out, words, word_count);
+	}
+
+	fclose(in);
+	fclose(out);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	char default_path[108];
+	snprintf(default_path, sizeof(default_path), "/tmp/dpc2sim-%d.sock", (int)getuid());
+	socket_path = default_path;
+	workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	int i;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-socket") && (i + 1 < argc))
+			socket_path = argv[++i];
+		else if (!strcmp(argv[i], "-workers") && (i + 1 < argc))
+			workers = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-cache_mb") && (i + 1 < argc))
+			cache_bytes = atoll(argv[++i]) << 20;
+		else {
+			fprintf(stderr, "Usage: %s [-socket path] [-workers N] [-cache_mb N]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (workers <= 0)
+		workers = 1;
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", socket_path);
+		return 1;
+	}
+	strcpy(address.sun_path, socket_path);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	unlink(socket_path);
+	mode_t mask = umask(0077);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+		perror(socket_path);
+		return 1;
+	}
+	umask(mask);
+
+	// a client that disconnects early must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("Serving %d workers on %s\n", workers, socket_path);
+	fflush(stdout);
+
+	while (1) {
+		int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+		if (connection < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			return 1;
+		}
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, serve_connection, (void *)(long)connection) != 0) {
+			close(connection);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+}
@@ -0,0 +1,256 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  SimPoint-style region selection
+
+  Streams a .dpc trace from stdin once, and splits it into fixed-size
+  intervals.  Each interval is summarized by its basic block vector (BBV):
+  how many instructions it executed in each basic block, where a basic block
+  starts after every instruction that writes the instruction pointer.
+
+  BBVs are not stored.  Every basic block start IP is hashed to a fixed
+  random vector of PROJECTED_DIMENSIONS elements, and an interval adds that
+  vector once per instruction it executes in the block, so each interval is
+  reduced to a small dense vector as it streams by (random projection).
+
+  The projected vectors are clustered with k-means, and the interval closest
+  to each cluster's centroid represents the cluster.  The regions file gets
+  one line per cluster:
+
+    <start instruction> <length> <weight>
+
+  where weight is the fraction of all intervals in that cluster.  Pass the
+  file to tools/sample_sim.sh with -regions.
+
+  Compile: gcc -Wall -O2 -o simpoint tools/simpoint.c
+  Usage:   zcat trace.dpc.gz | ./simpoint [-interval N] [-k N] [-seed N] > regions
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <assert.h>
+#include "../inc/trace.h"
+
+#define PROJECTED_DIMENSIONS 15
+#define KMEANS_ITERATIONS 100
+
+long long int interval_length = 1000000;
+int max_clusters = 10;
+unsigned long long int seed = 1;
+
+typedef struct interval
+{
+	double v[PROJECTED_DIMENSIONS];
+	int cluster;
+} interval_t;
+
+interval_t *intervals;
+int interval_count, interval_capacity;
+
+unsigned long long int mix(unsigned long long int x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+// Element d of the random projection vector of a basic block, uniform in [-1, 1).
+double projection(unsigned long long int block_ip, int d)
+{
+	unsigned long long int h = mix(block_ip * PROJECTED_DIMENSIONS + d + seed * 0x9e3779b97f4a7c15ULL);
+	return (double)(h >> 11) / (double)(1ULL << 52) - 1.0;
+}
+
+interval_t *new_interval()
+{
+	if (interval_count == interval_capacity) {
+		interval_capacity = interval_capacity ? 2 * interval_capacity : 64;
+		intervals = realloc(intervals, interval_capacity * sizeof(interval_t));
+		assert(intervals != NULL);
+	}
+	memset(&intervals[interval_count], 0, sizeof(interval_t));
+	return &intervals[interval_count++];
+}
+
+double distance(double *a, double *b)
+{
+	double sum = 0;
+	int d;
+	for (d = 0; d < PROJECTED_DIMENSIONS; d++)
+		sum += (a[d] - b[d]) * (a[d] - b[d]);
+	return sum;
+}
+
+// Clusters the intervals into at most k groups, and returns the centroids.
+double *kmeans(int k)
+{
+	double *centroids = calloc(k * PROJECTED_DIMENSIONS, sizeof(double));
+	int *sizes = calloc(k, sizeof(int));
+	int i, c, d, iteration;
+	assert(centroids != NULL && sizes != NULL);
+
+	// k-means++ seeding: each new centroid is an interval far from the ones already picked
+	double *nearest = malloc(interval_count * sizeof(double));
+	assert(nearest != NULL);
+	srand(seed);
+	memcpy(centroids, intervals[rand() % interval_count].v, sizeof(intervals[0].v));
+	for (i = 0; i < interval_count; i++)
+		nearest[i] = distance(intervals[i].v, centroids);
+	for (c = 1; c < k; c++) {
+		double total = 0;
+		for (i = 0; i < interval_count; i++)
+			total += nearest[i];
+		double pick = total * rand() / ((double)RAND_MAX + 1);
+		for (i = 0; i < interval_count - 1; i++) {
+			pick -= nearest[i];
+			if (pick < 0)
+				break;
+		}
+		memcpy(&centroids[c * PROJECTED_DIMENSIONS], intervals[i].v, sizeof(intervals[0].v));
+		for (i = 0; i < interval_count; i++) {
+			double dist = distance(intervals[i].v, &centroids[c * PROJECTED_DIMENSIONS]);
+			if (dist < nearest[i])
+				nearest[i] = dist;
+		}
+	}
+	free(nearest);
+
+	for (iteration = 0; iteration < KMEANS_ITERATIONS; iteration++) {
+		int changed = 0;
+		for (i = 0; i < interval_count; i++) {
+			int best = 0;
+			double best_distance = DBL_MAX;
+			for (c = 0; c < k; c++) {
+				double dist = distance(intervals[i].v, &centroids[c * PROJECTED_DIMENSIONS]);
+				if (dist < best_distance) {
+					best = c;
+					best_distance = dist;
+				}
+			}
+			if (intervals[i].cluster != best || iteration == 0)
+				changed = 1;
+			intervals[i].cluster = best;
+		}
+		if (!changed)
+			break;
+
+		memset(centroids, 0, k * PROJECTED_DIMENSIONS * sizeof(double));
+		memset(sizes, 0, k * sizeof(int));
+		for (i = 0; i < interval_count; i++) {
+			c = intervals[i].cluster;
+			sizes[c]++;
+			for (d = 0; d < PROJECTED_DIMENSIONS; d++)
+				centroids[c * PROJECTED_DIMENSIONS + d] += intervals[i].v[d];
+		}
+		for (c = 0; c < k; c++)
+			for (d = 0; d < PROJECTED_DIMENSIONS; d++)
+				if (sizes[c])
+					centroids[c * PROJECTED_DIMENSIONS + d] /= sizes[c];
+	}
+
+	free(sizes);
+	return centroids;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-interval") && (i + 1 < argc))
+			interval_length = atoll(argv[++i]);
+		else if (!strcmp(argv[i], "-k") && (i + 1 < argc))
+			max_clusters = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-seed") && (i + 1 < argc))
+			seed = atoll(argv[++i]);
+		else {
+			fprintf(stderr, "Usage: %s [-interval N] [-k N] [-seed N] < trace.dpc > regions\n", argv[0]);
+			return 1;
+		}
+	}
+	if (interval_length <= 0 || max_clusters <= 0) {
+		fprintf(stderr, "-interval and -k must be positive\n");
+		return 1;
+	}
+
+	trace_instr_format_t rec;
+	interval_t *current = NULL;
+	long long int in_interval = 0;
+	unsigned long long int block_ip = 0;
+	int block_start = 1;
+
+	while (fread(&rec, sizeof(rec), 1, stdin) == 1) {
+		if (current == NULL || in_interval == interval_length) {
+			current = new_interval();
+			in_interval = 0;
+		}
+		in_interval++;
+
+		if (block_start) {
+			block_ip = rec.ip;
+			block_start = 0;
+		}
+
+		int d;
+		for (d = 0; d < PROJECTED_DIMENSIONS; d++)
+			current->v[d] += projection(block_ip, d);
+
+		for (d = 0; d < NUM_INSTR_DESTINATIONS; d++)
+			if (rec.destination_registers[d] == REG_INSTRUCTION_POINTER)
+				block_start = 1;
+	}
+
+	if (interval_count == 0) {
+		fprintf(stderr, "Trace is empty\n");
+		return 1;
+	}
+
+	// a short tail interval would distort the clustering, so it is only kept if it is all there is
+	if (interval_count == 1)
+		interval_length = in_interval;
+	else if (in_interval < interval_length)
+		interval_count--;
+
+	// normalize each BBV by the number of instructions it covers
+	for (i = 0; i < interval_count; i++) {
+		int d;
+		for (d = 0; d < PROJECTED_DIMENSIONS; d++)
+			intervals[i].v[d] /= interval_length;
+	}
+
+	int k = (max_clusters < interval_count) ? max_clusters : interval_count;
+	double *centroids = kmeans(k);
+
+	fprintf(stderr, "%d intervals of %lld instructions, %d clusters\n", interval_count, interval_length, k);
+
+	int c;
+	for (c = 0; c < k; c++) {
+		int representative = -1, size = 0;
+		double best_distance = DBL_MAX;
+		for (i = 0; i < interval_count; i++) {
+			if (intervals[i].cluster != c)
+				continue;
+			size++;
+			double dist = distance(intervals[i].v, &centroids[c * PROJECTED_DIMENSIONS]);
+			if (dist < best_distance) {
+				representative = i;
+				best_distance = dist;
+			}
+		}
+		if (size == 0)
+			continue;
+
+		printf("%lld %lld %f\n", representative * interval_length, interval_length, (double)size / interval_count);
+	}
+
+	free(centroids);
+	return 0;
+}
@@ -0,0 +1,89 @@
+#!/bin/bash
+#
+# Data Prefetching Championship Simulator 2
+#
+# Decompressed trace cache shared by simulator processes.  Prints the path of
+# a decompressed copy of <trace.dpc.gz>, creating it first if no earlier run
+# has.  Simulators then read the copy directly instead of running zcat
+# themselves:
+#
+#   ./dpc2sim < $(tools/trace_cache.sh traces/mcf_trace2.dpc.gz)
+#
+# The cache lives in /dev/shm when it exists, so every process reading a
+# trace shares the same pages of memory; tools/cache_sim.c maps such files
+# read-only instead of copying them.  A lock file per trace makes concurrent
+# callers wait for the one process that decompresses it.  Each use marks the
+# copy as recently used, and once the cache is over its size limit the least
+# recently used copies are deleted.  Processes still reading a deleted copy
+# are not affected.
+#
+# Usage: tools/trace_cache.sh <trace>
+#
+# Environment:
+#   DPC2_TRACE_CACHE_DIR    cache directory (default /dev/shm/dpc2_trace_cache-<uid>,
+#                           or $TMPDIR/dpc2_trace_cache-<uid> without /dev/shm).  For
+#                           huge pages, point it at a tmpfs mounted with huge=within_size.
+#   DPC2_TRACE_CACHE_MB     size limit in megabytes (default 4096)
+#
+# Traces that are not gzip compressed are printed unchanged.
+#
+
+if [ $# -ne 1 ]; then
+  echo "Usage: $0 <trace>" >&2
+  exit 1
+fi
+
+trace=$1
+if [ ! -r "$trace" ]; then
+  echo "Cannot read $trace" >&2
+  exit 1
+fi
+case $trace in
+  *.gz) ;;
+  *) echo "$trace"; exit 0 ;;
+esac
+
+if [ -d /dev/shm ]; then
+  default_dir=/dev/shm/dpc2_trace_cache-$(id -u)
+else
+  default_dir=${TMPDIR:-/tmp}/dpc2_trace_cache-$(id -u)
+fi
+cache=${DPC2_TRACE_CACHE_DIR:-$default_dir}
+limit_mb=${DPC2_TRACE_CACHE_MB:-4096}
+mkdir -p "$cache" || exit 1
+
+# the name includes the trace's full path, size and modification time, so a changed trace gets a new copy
+key=$( { realpath "$trace"; stat -c '%s %Y' "$trace"; } | cksum | cut -d' ' -f1)
+name=$(basename "$trace" .gz)
+copy=$cache/${name%.dpc}-$key.dpc
+
+exec 9> "$copy.lock"
+flock 9
+if [ ! -f "$copy" ]; then
+  if ! zcat "$trace" > "$copy.tmp"; then
+    rm -f "$copy.tmp"
+    echo "Cannot decompress $trace" >&2
+    exit 1
+  fi
+  mv "$copy.tmp" "$copy"
+fi
+touch "$copy"
+exec 9>&-
+
+# evict least recently used copies, never the one just requested
+exec 8> "$cache/.evict.lock"
+flock 8
+used_kb=$(du -sk --exclude='*.lock' "$cache" | cut -f1)
+limit_kb=$((limit_mb * 1024))
+ls -tr "$cache" | grep '\.dpc$' | while read -r entry; do
+  [ "$used_kb" -le "$limit_kb" ] && break
+  [ "$cache/$entry" = "$copy" ] && continue
+  size_kb=$(du -k "$cache/$entry" | cut -f1)
+  # skip copies another caller is requesting at this moment
+  if flock -n "$cache/$entry.lock" rm -f "$cache/$entry"; then
+    used_kb=$((used_kb - size_kb))
+  fi
+done
+exec 8>&-
+
+echo "$copy"
@@ -0,0 +1,484 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Chunked trace compression, sampling and regions
+
+  Compresses the raw trace that pintool/dpc2_tracer.so writes, while it is
+  being written: point the tracer's -o at a named pipe, and run trace_pack
+  on the other end.  The output is a .dpc.gz file made of independently
+  decodable gzip members of -chunk instructions each, compressed by a pool
+  of threads (-threads, default the number of CPUs, at most 8) and written
+  in order by a writer thread, so compression keeps up with the tracer.
+  zcat reads the file like any other .dpc.gz trace.
+
+  Instead of the whole stream, trace_pack can keep:
+  - -sample N M: the first N instructions of every M, as segments named
+    sample_0, sample_1, ...
+  - -region <label> <start> <length>: the given instruction ranges, as
+    segments named <label>; several regions go into one file.
+  Every segment starts a new chunk, and <out>.idx lists the segments and
+  chunks with their byte offsets:
+
+    segment <label> <first input instruction> <instructions> <offset> <bytes>
+    chunk <first output instruction> <instructions> <offset> <bytes>
+
+  -extract writes one segment, decompressed, to stdout, so each segment can
+  be simulated as a workload of its own.
+
+  Compile: gcc -Wall -O2 -pthread -o trace_pack tools/trace_pack.c -lz
+  Usage:   mkfifo /tmp/trace.pipe
+           ./trace_pack -o prog.dpc.gz -sample 1000000 100000000 < /tmp/trace.pipe &
+           pin -t pintool/dpc2_tracer.so -o /tmp/trace.pipe -t 10000000000 -- prog
+           ./trace_pack -list prog.dpc.gz
+           ./trace_pack -extract sample_3 prog.dpc.gz | ./dpc2sim
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "../inc/trace.h"
+
+#define CHUNK_FREE 0
+#define CHUNK_FILLED 1
+#define CHUNK_COMPRESSING 2
+#define CHUNK_COMPRESSED 3
+
+#define MAX_REGIONS 256
+#define MAX_LABEL 64
+#define MAX_THREADS 8
+
+typedef struct chunk
+{
+	int state;
+	unsigned long long int sequence;
+	int records;
+	trace_instr_format_t *data;
+	unsigned char *compressed;
+	size_t compressed_capacity;
+	size_t compressed_size;
+} chunk_t;
+
+typedef struct segment
+{
+	char label[MAX_LABEL];
+	unsigned long long int start;
+	unsigned long long int instructions;
+	// first chunk sequence number of the segment
+	unsigned long long int first_chunk;
+} segment_t;
+
+typedef struct chunk_entry
+{
+	unsigned long long int first_instruction;
+	int records;
+	unsigned long long int offset;
+	unsigned long long int bytes;
+} chunk_entry_t;
+
+int chunk_records = 250000;
+int threads;
+int level = 6;
+unsigned long long int sample_length, sample_period;
+segment_t regions[MAX_REGIONS];
+int region_count;
+
+chunk_t *chunks;
+int chunk_slots;
+unsigned long long int chunks_filled;
+int input_done;
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+
+FILE *output;
+// written by the writer thread only
+chunk_entry_t *entries;
+unsigned long long int entry_count, entry_capacity, output_bytes, output_instructions;
+
+segment_t *segments;
+int segment_count, segment_capacity;
+
+void *compress_chunks(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	while (1) {
+		int i;
+		chunk_t *c = NULL;
+		for (i = 0; i < chunk_slots && c == NULL; i++)
+			if (chunks[i].state == CHUNK_FILLED)
+				c = &chunks[i];
+		if (c == NULL) {
+			if (input_done)
+				break;
+			pthread_cond_wait(&changed, &lock);
+			continue;
+		}
+		c->state = CHUNK_COMPRESSING;
+		pthread_mutex_unlock(&lock);
+
+		// each chunk is a complete gzip member, so it can be decoded on its own
+		z_stream z;
+		memset(&z, 0, sizeof(z));
+		int result = deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+		assert(result == Z_OK);
+		size_t input_size = c->records * sizeof(trace_instr_format_t);
+		size_t bound = deflateBound(&z, input_size);
+		if (bound > c->compressed_capacity) {
+			c->compressed = realloc(c->compressed, bound);
+			assert(c->compressed != NULL);
+			c->compressed_capacity = bound;
+		}
+		z.next_in = (unsigned char *)c->data;
+		z.avail_in = input_size;
+		z.next_out = c->compressed;
+		z.avail_out = c->compressed_capacity;
+		result = deflate(&z, Z_FINISH);
+		assert(result == Z_STREAM_END);
+		c->compressed_size = z.total_out;
+		deflateEnd(&z);
+
+		pthread_mutex_lock(&lock);
+		c->state = CHUNK_COMPRESSED;
+		pthread_cond_broadcast(&changed);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+void *write_chunks(void *arg)
+{
+	unsigned long long int next = 0;
+	pthread_mutex_lock(&lock);
+	while (1) {
+		chunk_t *c = &chunks[next % chunk_slots];
+		if (c->state != CHUNK_COMPRESSED || c->sequence != next) {
+			if (input_done && next == chunks_filled)
+				break;
+			pthread_cond_wait(&changed, &lock);
+			continue;
+		}
+		pthread_mutex_unlock(&lock);
+
+		if (fwrite(c->compressed, 1, c->compressed_size, output) != c->compressed_size) {
+			perror("write");
+			exit(1);
+		}
+		if (entry_count == entry_capacity) {
+			entry_capacity = entry_capacity ? 2 * entry_capacity : 1024;
+			entries = realloc(entries, entry_capacity * sizeof(chunk_entry_t));
+			assert(entries != NULL);
+		}
+		chunk_entry_t *e = &entries[entry_count++];
+		e->first_instruction = output_instructions;
+		e->records = c->records;
+		e->offset = output_bytes;
+		e->bytes = c->compressed_size;
+		output_instructions += c->records;
+		output_bytes += c->compressed_size;
+
+		pthread_mutex_lock(&lock);
+		c->state = CHUNK_FREE;
+		next++;
+		pthread_cond_broadcast(&changed);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+// Returns the slot for the next chunk, once the writer is done with its previous use.
+chunk_t *next_chunk()
+{
+	pthread_mutex_lock(&lock);
+	chunk_t *c = &chunks[chunks_filled % chunk_slots];
+	while (c->state != CHUNK_FREE)
+		pthread_cond_wait(&changed, &lock);
+	pthread_mutex_unlock(&lock);
+	c->records = 0;
+	return c;
+}
+
+void submit_chunk(chunk_t *c)
+{
+	pthread_mutex_lock(&lock);
+	c->sequence = chunks_filled++;
+	c->state = CHUNK_FILLED;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+}
+
+// Returns the number of the segment instruction n belongs to, or -1 if it is not kept.
+long long int segment_of(unsigned long long int n)
+{
+	if (region_count > 0) {
+		int r;
+		for (r = 0; r < region_count; r++)
+			if (n >= regions[r].start && n < regions[r].start + regions[r].instructions)
+				return r;
+		return -1;
+	}
+	if (sample_period > 0)
+		return (n % sample_period < sample_length) ? (long long int)(n / sample_period) : -1;
+	return 0;
+}
+
+void segment_label(long long int segment, char *label)
+{
+	if (region_count > 0)
+		strcpy(label, regions[segment].label);
+	else if (sample_period > 0)
+		sprintf(label, "sample_%lld", segment);
+	else
+		strcpy(label, "trace");
+}
+
+int pack(const char *path)
+{
+	output = fopen(path, "wb");
+	if (output == NULL) {
+		perror(path);
+		return 1;
+	}
+
+	// every slot holds a whole chunk, so memory use is 2 * threads * chunk_records * 48 bytes
+	chunk_slots = 2 * threads;
+	chunks = calloc(chunk_slots, sizeof(chunk_t));
+	assert(chunks != NULL);
+	int i;
+	for (i = 0; i < chunk_slots; i++) {
+		chunks[i].data = malloc(chunk_records * sizeof(trace_instr_format_t));
+		assert(chunks[i].data != NULL);
+	}
+
+	pthread_t writer, compressors[MAX_THREADS];
+	for (i = 0; i < threads; i++)
+		pthread_create(&compressors[i], NULL, compress_chunks, NULL);
+	pthread_create(&writer, NULL, write_chunks, NULL);
+
+	chunk_t *c = NULL;
+	long long int current = -1;
+	unsigned long long int n;
+	trace_instr_format_t rec;
+	for (n = 0; fread(&rec, sizeof(rec), 1, stdin) == 1; n++) {
+		long long int s = segment_of(n);
+		if (s < 0)
+			continue;
+		if (s != current) {
+			// a segment always starts a new chunk, so that it can be decoded on its own
+			if (c != NULL && c->records > 0)
+				submit_chunk(c);
+			c = next_chunk();
+			current = s;
+
+			if (segment_count == segment_capacity) {
+				segment_capacity = segment_capacity ? 2 * segment_capacity : 64;
+				segments = realloc(segments, segment_capacity * sizeof(segment_t));
+				assert(segments != NULL);
+			}
+			segment_t *seg = &segments[segment_count++];
+			segment_label(s, seg->label);
+			seg->start = n;
+			seg->instructions = 0;
+			seg->first_chunk = chunks_filled;
+		}
+		c->data[c->records++] = rec;
+		segments[segment_count - 1].instructions++;
+		if (c->records == chunk_records) {
+			submit_chunk(c);
+			c = next_chunk();
+		}
+	}
+	if (c != NULL && c->records > 0)
+		submit_chunk(c);
+
+	pthread_mutex_lock(&lock);
+	input_done = 1;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < threads; i++)
+		pthread_join(compressors[i], NULL);
+	pthread_join(writer, NULL);
+	if (fclose(output) != 0) {
+		perror(path);
+		return 1;
+	}
+
+	char index_path[4096];
+	snprintf(index_path, sizeof(index_path), "%s.idx", path);
+	FILE *index = fopen(index_path, "w");
+	if (index == NULL) {
+		perror(index_path);
+		return 1;
+	}
+	for (i = 0; i < segment_count; i++) {
+		unsigned long long int first = segments[i].first_chunk;
+		unsigned long long int last = (i + 1 < segment_count) ? segments[i + 1].first_chunk : entry_count;
+		fprintf(index, "segment %s %llu %llu %llu %llu\n", segments[i].label, segments[i].start, segments[i].instructions,
+		        entries[first].offset, entries[last - 1].offset + entries[last - 1].bytes - entries[first].offset);
+	}
+	unsigned long long int e;
+	for (e = 0; e < entry_count; e++)
+		fprintf(index, "chunk %llu %d %llu %llu\n", entries[e].first_instruction, entries[e].records, entries[e].offset, entries[e].bytes);
+	fclose(index);
+
+	fprintf(stderr, "%llu of %llu instructions in %d segments, %llu bytes (%.2f bytes per instruction)\n",
+	        output_instructions, n, segment_count, output_bytes, output_instructions ? (double)output_bytes / output_instructions : 0);
+	return 0;
+}
+
+// Writes the decompressed segment with this label to stdout.
+int extract(const char *label, const char *path)
+{
+	char index_path[4096];
+	snprintf(index_path, sizeof(index_path), "%s.idx", path);
+	FILE *index = fopen(index_path, "r");
+	if (index == NULL) {
+		perror(index_path);
+		return 1;
+	}
+	char kind[16], name[MAX_LABEL];
+	unsigned long long int start, instructions, offset, bytes;
+	int found = 0;
+	while (fscanf(index, "%15s %63s %llu %llu %llu %llu", kind, name, &start, &instructions, &offset, &bytes) == 6)
+		if (!strcmp(kind, "segment") && !strcmp(name, label)) {
+			found = 1;
+			break;
+		}
+	fclose(index);
+	if (!found) {
+		fprintf(stderr, "No segment %s in %s\n", label, index_path);
+		return 1;
+	}
+
+	FILE *f = fopen(path, "rb");
+	if (f == NULL || fseeko(f, offset, SEEK_SET) != 0) {
+		perror(path);
+		return 1;
+	}
+
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	inflateInit2(&z, 15 + 16);
+	unsigned char in[1 << 16], out[1 << 16];
+	int result = Z_OK;
+	while (bytes > 0) {
+		size_t want = (bytes < sizeof(in)) ? bytes : sizeof(in);
+		if (fread(in, 1, want, f) != want) {
+			fprintf(stderr, "%s is truncated\n", path);
+			return 1;
+		}
+		bytes -= want;
+		z.next_in = in;
+		z.avail_in = want;
+		while (z.avail_in > 0) {
+			z.next_out = out;
+			z.avail_out = sizeof(out);
+			result = inflate(&z, Z_NO_FLUSH);
+			if (result != Z_OK && result != Z_STREAM_END) {
+				fprintf(stderr, "%s is corrupt\n", path);
+				return 1;
+			}
+			fwrite(out, 1, sizeof(out) - z.avail_out, stdout);
+			// the segment is a series of gzip members
+			if (result == Z_STREAM_END)
+				inflateReset(&z);
+		}
+	}
+	// flush what the last member still holds
+	do {
+		z.next_out = out;
+		z.avail_out = sizeof(out);
+		result = inflate(&z, Z_FINISH);
+		fwrite(out, 1, sizeof(out) - z.avail_out, stdout);
+	} while (result == Z_OK && z.avail_out == 0);
+	inflateEnd(&z);
+	fclose(f);
+	return 0;
+}
+
+void usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-o out.dpc.gz] [-chunk N] [-threads N] [-level N] [-sample N M] [-region label start length]... < trace\n"
+	        "       %s -extract <label> <file.dpc.gz> > segment.dpc\n"
+	        "       %s -list <file.dpc.gz>\n", program, program, program);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = "default_trace.dpc.gz";
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	if (argc == 4 && !strcmp(argv[1], "-extract"))
+		return extract(argv[2], argv[3]);
+	if (argc == 3 && !strcmp(argv[1], "-list")) {
+		char index_path[4096];
+		snprintf(index_path, sizeof(index_path), "%s.idx", argv[2]);
+		FILE *index = fopen(index_path, "r");
+		if (index == NULL) {
+			perror(index_path);
+			return 1;
+		}
+		char line[512];
+		while (fgets(line, sizeof(line), index) != NULL)
+			if (!strncmp(line, "segment ", 8))
+				fputs(line + 8, stdout);
+		fclose(index);
+		return 0;
+	}
+
+	int i;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-o") && (i + 1 < argc))
+			path = argv[++i];
+		else if (!strcmp(argv[i], "-chunk") && (i + 1 < argc))
+			chunk_records = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-threads") && (i + 1 < argc))
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-level") && (i + 1 < argc))
+			level = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-sample") && (i + 2 < argc)) {
+			sample_length = strtoull(argv[++i], NULL, 0);
+			sample_period = strtoull(argv[++i], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-region") && (i + 3 < argc) && region_count < MAX_REGIONS) {
+			snprintf(regions[region_count].label, MAX_LABEL, "%s", argv[++i]);
+			regions[region_count].start = strtoull(argv[++i], NULL, 0);
+			regions[region_count].instructions = strtoull(argv[++i], NULL, 0);
+			region_count++;
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (chunk_records <= 0 || threads <= 0 || threads > MAX_THREADS || (sample_period > 0 && (sample_length == 0 || sample_length > sample_period))) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (region_count > 0 && sample_period > 0) {
+		fprintf(stderr, "-sample and -region cannot be combined\n");
+		return 1;
+	}
+	int j;
+	for (i = 0; i < region_count; i++)
+		for (j = 0; j < i; j++) {
+			if (!strcmp(regions[i].label, regions[j].label)) {
+				fprintf(stderr, "Region %s is given twice\n", regions[i].label);
+				return 1;
+			}
+			if (regions[i].start < regions[j].start + regions[j].instructions && regions[j].start < regions[i].start + regions[i].instructions) {
+				fprintf(stderr, "Regions %s and %s overlap\n", regions[j].label, regions[i].label);
+				return 1;
+			}
+		}
+
+	return pack(path);
+}
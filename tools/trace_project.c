@@ -0,0 +1,106 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Memory-only trace projection
+
+  Reads a .dpc trace from stdin, and writes only its memory operations (IP,
+  address, load or store, and the instruction gap to the previous one) to
+  stdout as a memory-only trace; the format is described in inc/trace.h.
+  tools/cache_sim.c reads these traces like .dpc traces, with the same
+  instruction counts, so -warmup_instructions and -simulation_instructions
+  keep their meaning.  Register fields are dropped, so tools/simpoint.c
+  cannot use them.
+
+  Compile: gcc -Wall -O2 -o trace_project tools/trace_project.c
+  Usage:   zcat trace.dpc.gz | ./trace_project > trace.dpcm
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "../inc/trace.h"
+
+unsigned long long int block_ip[MEMORY_TRACE_BLOCK];
+unsigned long long int block_addr[MEMORY_TRACE_BLOCK];
+unsigned int block_gap[MEMORY_TRACE_BLOCK];
+unsigned char block_store[MEMORY_TRACE_BLOCK];
+unsigned int block_count;
+unsigned long long int bytes_written;
+
+void write_block()
+{
+	if (block_count == 0)
+		return;
+	fwrite(&block_count, sizeof(block_count), 1, stdout);
+	fwrite(block_ip, sizeof(block_ip[0]), block_count, stdout);
+	fwrite(block_addr, sizeof(block_addr[0]), block_count, stdout);
+	fwrite(block_gap, sizeof(block_gap[0]), block_count, stdout);
+	fwrite(block_store, sizeof(block_store[0]), block_count, stdout);
+	bytes_written += sizeof(block_count) + block_count * (sizeof(block_ip[0]) + sizeof(block_addr[0]) + sizeof(block_gap[0]) + sizeof(block_store[0]));
+	block_count = 0;
+}
+
+void add_operation(unsigned long long int ip, unsigned long long int addr, unsigned int gap, int store)
+{
+	block_ip[block_count] = ip;
+	block_addr[block_count] = addr;
+	block_gap[block_count] = gap;
+	block_store[block_count] = store;
+	if (++block_count == MEMORY_TRACE_BLOCK)
+		write_block();
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 1) {
+		fprintf(stderr, "Usage: %s < trace.dpc > trace.dpcm\n", argv[0]);
+		return 1;
+	}
+
+	fwrite(MEMORY_TRACE_MAGIC, 1, 8, stdout);
+	bytes_written = 8;
+
+	trace_instr_format_t rec;
+	unsigned long long int instructions = 0, operations = 0;
+	// instructions since the last one with a memory operation, counting that one
+	unsigned long long int gap = 1;
+
+	while (fread(&rec, sizeof(rec), 1, stdin) == 1) {
+		instructions++;
+		int first = 1, j;
+		for (j = 0; j < NUM_INSTR_SOURCES + NUM_INSTR_DESTINATIONS; j++) {
+			int store = (j >= NUM_INSTR_SOURCES);
+			unsigned long long int addr = store ? rec.destination_memory[j - NUM_INSTR_SOURCES] : rec.source_memory[j];
+			if (addr == 0)
+				continue;
+			if (first && gap > UINT_MAX) {
+				fprintf(stderr, "More than %u instructions without a memory operation\n", UINT_MAX);
+				return 1;
+			}
+			add_operation(rec.ip, addr, first ? gap : 0, store);
+			operations++;
+			first = 0;
+		}
+		gap = first ? gap + 1 : 1;
+	}
+	write_block();
+
+	unsigned int end = 0;
+	unsigned long long int trailing = gap - 1;
+	fwrite(&end, sizeof(end), 1, stdout);
+	fwrite(&trailing, sizeof(trailing), 1, stdout);
+	bytes_written += sizeof(end) + sizeof(trailing);
+	if (fflush(stdout) != 0) {
+		perror("stdout");
+		return 1;
+	}
+
+	fprintf(stderr, "%llu instructions, %llu memory operations, %llu bytes (%.1fx smaller)\n",
+	        instructions, operations, bytes_written, (double)instructions * TRACE_RECORD_SIZE / bytes_written);
+	return 0;
+}
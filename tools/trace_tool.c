@@ -0,0 +1,638 @@
+//
+// Data Prefetching Championship Simulator 2
+//
+
+/*
+
+  Trace utility: validation, counting, indexing, slicing and concatenation
+
+    trace_tool validate <trace>...
+      Reads every record, and reports truncated or corrupt files, records
+      with a zero IP, and memory addresses that are not canonical user-space
+      addresses.  Exits with 1 if any trace has a problem.
+
+    trace_tool count <trace>...
+      Prints the number of instructions in each trace.
+
+    trace_tool index [-span N] <trace.dpc.gz>...
+      Writes <trace.dpc.gz>.zidx, a list of access points every N
+      instructions (default 1,000,000) into the compressed stream, each with
+      the 32 KB of history needed to resume decompression there, in the way
+      of zlib's examples/zran.c.  Works with multi-member gzip files, such
+      as those of tools/trace_pack.c and pigz.
+
+    trace_tool cat [-o out] <trace>[:<start>[:<count>]]...
+      Writes the instructions start .. start + count - 1 of each trace, one
+      after the other, to stdout or out (compressed if it ends in .gz).
+      Uncompressed traces, and compressed traces with an index, are read
+      from the first instruction wanted; others are decompressed from their
+      beginning.
+
+  Compile: gcc -Wall -O2 -o trace_tool tools/trace_tool.c -lz
+  Example: ./trace_tool index traces/gcc_trace2.dpc.gz
+           ./trace_tool cat traces/gcc_trace2.dpc.gz:1000000:500000 | ./dpc2sim
+
+ */
+
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "../inc/trace.h"
+
+#define INDEX_MAGIC "DPC2ZIDX"
+#define WINDOW_SIZE 32768
+#define CHUNK_SIZE 65536
+
+// user-space addresses on x86-64 are below 2^47
+#define USER_ADDRESS_LIMIT (1ULL << 47)
+
+typedef struct access_point
+{
+	// uncompressed and compressed byte offsets of a deflate block boundary
+	unsigned long long int out;
+	unsigned long long int in;
+	// bits of the byte before in that belong to the block, or 0
+	int bits;
+	unsigned char window[WINDOW_SIZE];
+} access_point_t;
+
+typedef struct trace_index
+{
+	unsigned long long int span;
+	unsigned long long int total_out;
+	// size and modification time of the trace when the index was built
+	unsigned long long int trace_size;
+	unsigned long long int trace_mtime;
+	unsigned long long int count;
+	access_point_t *points;
+} trace_index_t;
+
+int ends_with(const char *s, const char *suffix)
+{
+	size_t length = strlen(s), suffix_length = strlen(suffix);
+	return length >= suffix_length && !strcmp(s + length - suffix_length, suffix);
+}
+
+void add_point(trace_index_t *index, unsigned long long int out, unsigned long long int in, int bits,
+               unsigned char *window, unsigned int left)
+{
+	index->points = realloc(index->points, (index->count + 1) * sizeof(access_point_t));
+	if (index->points == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	access_point_t *p = &index->points[index->count++];
+	p->out = out;
+	p->in = in;
+	p->bits = bits;
+	// the window is a ring that the next output overwrites from WINDOW_SIZE - left on
+	if (left)
+		memcpy(p->window, window + WINDOW_SIZE - left, left);
+	if (left < WINDOW_SIZE)
+		memcpy(p->window + left, window, WINDOW_SIZE - left);
+}
+
+// Decompresses the whole gzip file, adding an access point at the first deflate block boundary
+// after every span bytes of output.  Returns 0, or -1 if the file is truncated or corrupt.
+int build_index(FILE *f, unsigned long long int span, trace_index_t *index)
+{
+	unsigned char input[CHUNK_SIZE], window[WINDOW_SIZE];
+	unsigned long long int total_in = 0, total_out = 0, last = 0;
+	int member_open = 0, first = 1;
+	z_stream z;
+
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, 15 + 32) != Z_OK)
+		return -1;
+	index->span = span;
+	index->count = 0;
+	index->points = NULL;
+
+	while (1) {
+		if (z.avail_in == 0) {
+			z.avail_in = fread(input, 1, CHUNK_SIZE, f);
+			z.next_in = input;
+			if (z.avail_in == 0)
+				break;
+		}
+		if (z.avail_out == 0) {
+			z.avail_out = WINDOW_SIZE;
+			z.next_out = window;
+		}
+
+		total_in += z.avail_in;
+		total_out += z.avail_out;
+		int result = inflate(&z, Z_BLOCK);
+		total_in -= z.avail_in;
+		total_out -= z.avail_out;
+		if (result != Z_OK && result != Z_STREAM_END) {
+			inflateEnd(&z);
+			return -1;
+		}
+		member_open = 1;
+
+		if (result == Z_STREAM_END) {
+			// another gzip member may follow
+			inflateReset(&z);
+			member_open = 0;
+			continue;
+		}
+
+		// between two deflate blocks of a member; after its last block, the next member's header follows
+		if ((z.data_type & 128) && !(z.data_type & 64) && (first || total_out - last >= span)) {
+			add_point(index, total_out, total_in, z.data_type & 7, window, z.avail_out);
+			last = total_out;
+			first = 0;
+		}
+	}
+	inflateEnd(&z);
+	index->total_out = total_out;
+	return member_open ? -1 : 0;
+}
+
+void index_path(const char *trace, char *path, size_t size)
+{
+	snprintf(path, size, "%s.zidx", trace);
+}
+
+int write_index(const char *trace, trace_index_t *index)
+{
+	char path[4096];
+	index_path(trace, path, sizeof(path));
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	fwrite(INDEX_MAGIC, 1, 8, f);
+	fwrite(&index->span, sizeof(index->span), 1, f);
+	fwrite(&index->total_out, sizeof(index->total_out), 1, f);
+	fwrite(&index->trace_size, sizeof(index->trace_size), 1, f);
+	fwrite(&index->trace_mtime, sizeof(index->trace_mtime), 1, f);
+	fwrite(&index->count, sizeof(index->count), 1, f);
+	fwrite(index->points, sizeof(access_point_t), index->count, f);
+	if (fclose(f) != 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+// Loads the index of trace, and returns 0, or -1 if there is none or it is out of date.
+int read_index(const char *trace, trace_index_t *index)
+{
+	char path[4096], magic[8];
+	struct stat st;
+	index_path(trace, path, sizeof(path));
+	FILE *f = fopen(path, "rb");
+	if (f == NULL || stat(trace, &st) != 0)
+		return -1;
+
+	int ok = fread(magic, 1, 8, f) == 8 && !memcmp(magic, INDEX_MAGIC, 8) &&
+	         fread(&index->span, sizeof(index->span), 1, f) == 1 &&
+	         fread(&index->total_out, sizeof(index->total_out), 1, f) == 1 &&
+	         fread(&index->trace_size, sizeof(index->trace_size), 1, f) == 1 &&
+	         fread(&index->trace_mtime, sizeof(index->trace_mtime), 1, f) == 1 &&
+	         fread(&index->count, sizeof(index->count), 1, f) == 1;
+	if (ok && (index->trace_size != (unsigned long long int)st.st_size || index->trace_mtime != (unsigned long long int)st.st_mtime)) {
+		fprintf(stderr, "%s is out of date, rebuild it with trace_tool index\n", path);
+		ok = 0;
+	}
+	if (ok) {
+		index->points = malloc(index->count * sizeof(access_point_t));
+		ok = index->points != NULL && fread(index->points, sizeof(access_point_t), index->count, f) == index->count;
+	}
+	fclose(f);
+	return ok ? 0 : -1;
+}
+
+// Writes length uncompressed bytes, starting at offset, of an indexed gzip file to out.
+// Returns the number of bytes written.
+unsigned long long int extract(FILE *f, trace_index_t *index, unsigned long long int offset, unsigned long long int length,
+                               void (*write)(void *, const unsigned char *, size_t), void *out)
+{
+	unsigned char input[CHUNK_SIZE], output[WINDOW_SIZE];
+	unsigned long long int written = 0;
+	z_stream z;
+
+	if (index->count == 0 || length == 0)
+		return 0;
+
+	// the last access point at or before offset
+	unsigned long long int lo = 0, hi = index->count;
+	while (hi - lo > 1) {
+		unsigned long long int mid = (lo + hi) / 2;
+		if (index->points[mid].out <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	access_point_t *p = &index->points[lo];
+
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, -15) != Z_OK)
+		return 0;
+	if (fseeko(f, p->in - (p->bits ? 1 : 0), SEEK_SET) != 0) {
+		inflateEnd(&z);
+		return 0;
+	}
+	if (p->bits) {
+		int c = getc(f);
+		if (c == EOF) {
+			inflateEnd(&z);
+			return 0;
+		}
+		inflatePrime(&z, p->bits, c >> (8 - p->bits));
+	}
+	inflateSetDictionary(&z, p->window, WINDOW_SIZE);
+
+	unsigned long long int skip = offset - p->out;
+	// decompression resumes as raw deflate, which leaves the member's gzip trailer to us;
+	// later members are read in gzip mode, where zlib consumes their trailers itself
+	int raw = 1;
+	// bytes of the gzip trailer still to skip after the raw deflate stream ended
+	int trailer = 0;
+	while (written < length) {
+		if (z.avail_in == 0) {
+			z.avail_in = fread(input, 1, CHUNK_SIZE, f);
+			z.next_in = input;
+			if (z.avail_in == 0)
+				break;
+		}
+		if (trailer > 0) {
+			unsigned int n = (z.avail_in < (unsigned int)trailer) ? z.avail_in : (unsigned int)trailer;
+			z.next_in += n;
+			z.avail_in -= n;
+			trailer -= n;
+			if (trailer == 0)
+				inflateReset2(&z, 15 + 16);
+			continue;
+		}
+
+		z.next_out = output;
+		z.avail_out = WINDOW_SIZE;
+		int result = inflate(&z, Z_NO_FLUSH);
+		if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+			break;
+
+		unsigned long long int have = WINDOW_SIZE - z.avail_out;
+		unsigned char *data = output;
+		if (skip > 0) {
+			unsigned long long int n = (skip < have) ? skip : have;
+			skip -= n;
+			data += n;
+			have -= n;
+		}
+		if (have > length - written)
+			have = length - written;
+		if (have > 0)
+			write(out, data, have);
+		written += have;
+
+		if (result == Z_STREAM_END && raw) {
+			// the member ends with an 8 byte trailer, and another member may follow
+			raw = 0;
+			trailer = 8;
+			if (z.avail_in >= 8) {
+				z.next_in += 8;
+				z.avail_in -= 8;
+				trailer = 0;
+				inflateReset2(&z, 15 + 16);
+			}
+		}
+		else if (result == Z_STREAM_END)
+			inflateReset(&z);
+	}
+	inflateEnd(&z);
+	return written;
+}
+
+// Output of the cat command, either a plain stream or a gzip file.
+FILE *cat_file;
+gzFile cat_gz;
+unsigned long long int cat_bytes;
+
+void cat_write(void *unused, const unsigned char *data, size_t size)
+{
+	if (cat_gz != NULL)
+		gzwrite(cat_gz, data, size);
+	else
+		fwrite(data, 1, size, cat_file);
+	cat_bytes += size;
+}
+
+// Writes count instructions of trace from start on; count 0 means up to the end.
+int cat_trace(const char *trace, unsigned long long int start, unsigned long long int count)
+{
+	unsigned long long int offset = start * TRACE_RECORD_SIZE;
+	unsigned long long int length = count ? count * TRACE_RECORD_SIZE : ~0ULL;
+	unsigned long long int before = cat_bytes;
+	trace_index_t index;
+
+	if (ends_with(trace, ".gz") && read_index(trace, &index) == 0) {
+		FILE *f = fopen(trace, "rb");
+		if (f == NULL) {
+			perror(trace);
+			return -1;
+		}
+		if (offset < index.total_out)
+			extract(f, &index, offset, length, cat_write, NULL);
+		fclose(f);
+		free(index.points);
+	}
+	else {
+		// gzread reads uncompressed files as they are, and gzseek seeks in them directly
+		gzFile g = gzopen(trace, "rb");
+		if (g == NULL) {
+			perror(trace);
+			return -1;
+		}
+		gzbuffer(g, CHUNK_SIZE);
+		if (offset > 0 && gzseek(g, offset, SEEK_SET) < 0) {
+			gzclose(g);
+			return 0;
+		}
+		unsigned char buffer[CHUNK_SIZE];
+		unsigned long long int done = 0;
+		while (done < length) {
+			unsigned int want = (length - done < CHUNK_SIZE) ? (unsigned int)(length - done) : CHUNK_SIZE;
+			int n = gzread(g, buffer, want);
+			if (n <= 0)
+				break;
+			cat_write(NULL, buffer, n);
+			done += n;
+		}
+		gzclose(g);
+	}
+
+	unsigned long long int instructions = (cat_bytes - before) / TRACE_RECORD_SIZE;
+	if (count && instructions < count) {
+		fprintf(stderr, "%s: only %llu of %llu instructions from %llu on\n", trace, instructions, count, start);
+		return -1;
+	}
+	return 0;
+}
+
+int command_cat(int argc, char **argv)
+{
+	int i = 0;
+	const char *out_path = NULL;
+	if (argc >= 2 && !strcmp(argv[0], "-o")) {
+		out_path = argv[1];
+		i = 2;
+	}
+	if (i == argc) {
+		fprintf(stderr, "Usage: trace_tool cat [-o out] <trace>[:<start>[:<count>]]...\n");
+		return 1;
+	}
+
+	cat_file = stdout;
+	if (out_path != NULL && ends_with(out_path, ".gz"))
+		cat_gz = gzopen(out_path, "wb");
+	else if (out_path != NULL)
+		cat_file = fopen(out_path, "wb");
+	if (cat_file == NULL || (out_path != NULL && ends_with(out_path, ".gz") && cat_gz == NULL)) {
+		perror(out_path);
+		return 1;
+	}
+
+	int failed = 0;
+	for (; i < argc; i++) {
+		char trace[4096];
+		unsigned long long int start = 0, count = 0;
+		snprintf(trace, sizeof(trace), "%s", argv[i]);
+		// the range follows the last colons, so that paths may contain colons too
+		char *colon = strrchr(trace, ':');
+		if (colon != NULL && colon[1] != '\0' && strspn(colon + 1, "0123456789") == strlen(colon + 1)) {
+			char *range = colon + 1;
+			*colon = '\0';
+			colon = strrchr(trace, ':');
+			if (colon != NULL && colon[1] != '\0' && strspn(colon + 1, "0123456789") == strlen(colon + 1)) {
+				*colon = '\0';
+				start = strtoull(colon + 1, NULL, 10);
+				count = strtoull(range, NULL, 10);
+			}
+			else
+				start = strtoull(range, NULL, 10);
+		}
+		if (cat_trace(trace, start, count) != 0)
+			failed = 1;
+	}
+
+	if (cat_gz != NULL)
+		gzclose(cat_gz);
+	else if (fflush(cat_file) != 0 || (cat_file != stdout && fclose(cat_file) != 0)) {
+		perror(out_path ? out_path : "stdout");
+		failed = 1;
+	}
+	return failed;
+}
+
+int command_index(int argc, char **argv)
+{
+	unsigned long long int span = 1000000;
+	int i = 0, failed = 0;
+	if (argc >= 2 && !strcmp(argv[0], "-span")) {
+		span = strtoull(argv[1], NULL, 0);
+		i = 2;
+	}
+	if (i == argc || span == 0) {
+		fprintf(stderr, "Usage: trace_tool index [-span N] <trace.dpc.gz>...\n");
+		return 1;
+	}
+
+	for (; i < argc; i++) {
+		trace_index_t index;
+		struct stat st;
+		FILE *f = fopen(argv[i], "rb");
+		if (f == NULL || fstat(fileno(f), &st) != 0) {
+			perror(argv[i]);
+			failed = 1;
+			continue;
+		}
+		if (build_index(f, span * TRACE_RECORD_SIZE, &index) != 0) {
+			fprintf(stderr, "%s: truncated or corrupt\n", argv[i]);
+			failed = 1;
+		}
+		else {
+			index.trace_size = st.st_size;
+			index.trace_mtime = st.st_mtime;
+			if (write_index(argv[i], &index) != 0)
+				failed = 1;
+			else
+				printf("%s: %llu instructions, %llu access points\n", argv[i], index.total_out / TRACE_RECORD_SIZE, index.count);
+		}
+		fclose(f);
+		free(index.points);
+	}
+	return failed;
+}
+
+typedef struct trace_check
+{
+	unsigned long long int instructions;
+	unsigned long long int memory_operations;
+	unsigned long long int branches;
+	unsigned long long int zero_ips;
+	unsigned long long int bad_addresses;
+	unsigned long long int first_problem;
+	int partial_bytes;
+	int corrupt;
+} trace_check_t;
+
+void check_record(trace_check_t *c, trace_instr_format_t *rec)
+{
+	int j, problem = 0;
+	if (rec->ip == 0) {
+		c->zero_ips++;
+		problem = 1;
+	}
+	for (j = 0; j < NUM_INSTR_DESTINATIONS; j++) {
+		if (rec->destination_registers[j] == REG_INSTRUCTION_POINTER)
+			c->branches++;
+		if (rec->destination_memory[j]) {
+			c->memory_operations++;
+			if (rec->destination_memory[j] >= USER_ADDRESS_LIMIT) {
+				c->bad_addresses++;
+				problem = 1;
+			}
+		}
+	}
+	for (j = 0; j < NUM_INSTR_SOURCES; j++)
+		if (rec->source_memory[j]) {
+			c->memory_operations++;
+			if (rec->source_memory[j] >= USER_ADDRESS_LIMIT) {
+				c->bad_addresses++;
+				problem = 1;
+			}
+		}
+	if (problem && c->first_problem == ~0ULL)
+		c->first_problem = c->instructions;
+	c->instructions++;
+}
+
+// Reads the whole trace; with validate 0, it only counts instructions.
+int scan_trace(const char *trace, trace_check_t *c, int validate)
+{
+	memset(c, 0, sizeof(*c));
+	c->first_problem = ~0ULL;
+
+	gzFile g = gzopen(trace, "rb");
+	if (g == NULL) {
+		perror(trace);
+		return -1;
+	}
+	gzbuffer(g, CHUNK_SIZE);
+
+	trace_instr_format_t records[CHUNK_SIZE / TRACE_RECORD_SIZE];
+	int n;
+	while ((n = gzread(g, records, sizeof(records))) > 0) {
+		int i, whole = n / TRACE_RECORD_SIZE;
+		if (validate)
+			for (i = 0; i < whole; i++)
+				check_record(c, &records[i]);
+		else
+			c->instructions += whole;
+		c->partial_bytes = n % TRACE_RECORD_SIZE;
+		if (c->partial_bytes)
+			break;
+	}
+	int error;
+	gzerror(g, &error);
+	c->corrupt = (n < 0) || (error != Z_OK && error != Z_BUF_ERROR);
+	// a gzip file that ends early reads like a complete one, apart from this error
+	if (error == Z_BUF_ERROR)
+		c->corrupt = 1;
+	gzclose(g);
+	return 0;
+}
+
+int command_validate(int argc, char **argv)
+{
+	int i, failed = 0;
+	if (argc == 0) {
+		fprintf(stderr, "Usage: trace_tool validate <trace>...\n");
+		return 1;
+	}
+	for (i = 0; i < argc; i++) {
+		trace_check_t c;
+		if (scan_trace(argv[i], &c, 1) != 0) {
+			failed = 1;
+			continue;
+		}
+		printf("%s: %llu instructions, %llu memory operations, %llu branches\n", argv[i], c.instructions, c.memory_operations, c.branches);
+		int bad = 0;
+		if (c.corrupt) {
+			printf("  compressed data is corrupt or truncated\n");
+			bad = 1;
+		}
+		if (c.partial_bytes) {
+			printf("  ends with a partial record of %d bytes\n", c.partial_bytes);
+			bad = 1;
+		}
+		if (c.zero_ips) {
+			printf("  %llu records with a zero IP\n", c.zero_ips);
+			bad = 1;
+		}
+		if (c.bad_addresses) {
+			printf("  %llu memory addresses outside user space\n", c.bad_addresses);
+			bad = 1;
+		}
+		if (c.first_problem != ~0ULL)
+			printf("  first bad record: instruction %llu\n", c.first_problem);
+		printf("  %s\n", bad ? "INVALID" : "OK");
+		failed |= bad;
+	}
+	return failed;
+}
+
+int command_count(int argc, char **argv)
+{
+	int i, failed = 0;
+	if (argc == 0) {
+		fprintf(stderr, "Usage: trace_tool count <trace>...\n");
+		return 1;
+	}
+	for (i = 0; i < argc; i++) {
+		trace_index_t index;
+		struct stat st;
+		if (!ends_with(argv[i], ".gz") && stat(argv[i], &st) == 0) {
+			printf("%s: %llu\n", argv[i], (unsigned long long int)st.st_size / TRACE_RECORD_SIZE);
+		}
+		else if (ends_with(argv[i], ".gz") && read_index(argv[i], &index) == 0) {
+			printf("%s: %llu\n", argv[i], index.total_out / TRACE_RECORD_SIZE);
+			free(index.points);
+		}
+		else {
+			trace_check_t c;
+			if (scan_trace(argv[i], &c, 0) != 0) {
+				failed = 1;
+				continue;
+			}
+			printf("%s: %llu\n", argv[i], c.instructions);
+		}
+	}
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 2 && !strcmp(argv[1], "validate"))
+		return command_validate(argc - 2, argv + 2);
+	if (argc >= 2 && !strcmp(argv[1], "count"))
+		return command_count(argc - 2, argv + 2);
+	if (argc >= 2 && !strcmp(argv[1], "index"))
+		return command_index(argc - 2, argv + 2);
+	if (argc >= 2 && !strcmp(argv[1], "cat"))
+		return command_cat(argc - 2, argv + 2);
+
+	fprintf(stderr, "Usage: %s validate <trace>...\n"
+	        "       %s count <trace>...\n"
+	        "       %s index [-span N] <trace.dpc.gz>...\n"
+	        "       %s cat [-o out] <trace>[:<start>[:<count>]]...\n", argv[0], argv[0], argv[0], argv[0]);
+	return 1;
+}